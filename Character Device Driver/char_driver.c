@@ -7,351 +7,3281 @@
 #include <linux/cdev.h>
 #include <linux/device.h>
 #include <linux/moduleparam.h>
+#include <linux/xarray.h>
+#include <linux/highmem.h>
+#include <linux/mm.h>
+#include <linux/pagemap.h>
+#include <linux/pfn_t.h>
+#include <linux/spinlock.h>
+#include <linux/rwsem.h>
+#include <linux/atomic.h>
+#include <linux/uio.h>
+#include <linux/splice.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/ktime.h>
+#include <linux/percpu.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/log2.h>
+#include <linux/list.h>
+#include <linux/nodemask.h>
+#include <linux/crypto.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
+#include <linux/math64.h>
+#include <linux/kref.h>
+#include <linux/capability.h>
+#include <linux/blkdev.h>
+#include <linux/blk-mq.h>
+#include <linux/genhd.h>
+#include <linux/file.h>
+#include <linux/bvec.h>
+#include <linux/crc32c.h>
 
-#define DEVICE_NAME "mycdrv"
+#include "mycdrv_ioctl.h"
+#include "mycdrv_core.h"
+
+#define CREATE_TRACE_POINTS
+#include "mycdrv_trace.h"
 
-#define CDRV_IOC_MAGIC 'Z'
-#define ASP_CLEAR_BUF _IOW(CDRV_IOC_MAGIC, 1, int)
+#define DEVICE_NAME "mycdrv"
 
 static size_t ramdisk_size = (16 * PAGE_SIZE);
-static unsigned int NUM_DEVICES = 3;
+static unsigned int NUM_DEVICES = 3; // devices created at load time, more are added through /dev/mycdrv-control
+static bool stream_mode; // create the devices as FIFO stream buffers instead of random-access ramdisks
+static int numa_node = NUMA_NO_NODE; // node the ramdisk pages are allocated on, NUMA_NO_NODE is the allocating cpu's node
+static bool numa_interleave;          // spread the ramdisk pages over the online nodes instead
+static unsigned int compress_interval; // seconds a page must stay untouched before it is compressed, 0 disables
+static bool blkdev;                    // give the devices created at load time a block device frontend
+static bool huge_pages;                // back the devices created at load time with huge page runs
+static bool integrity;                 // keep a crc32c of every page of the devices created at load time
+static bool latency_stats;             // time every read and write for lock_wait_ns and the latency histograms
 static dev_t maj_min;              // device number = majornumber : minornumber
 static struct class *mycdrv_class; // class clueprint to define our device class later in init.
 int major_num;
 int minor_num;
+static struct dentry *mycdrv_debugfs_root; // /sys/kernel/debug/mycdrv
+
+// the control node takes the minor after the last device
+#define MYCDRV_CTL_MINOR MYCDRV_MAX_DEVICES
+#define MYCDRV_MINORS (MYCDRV_MAX_DEVICES + 1)
+static struct cdev mycdrv_ctl_cdev;
+static int mycdrv_blk_major; // major number of the /dev/mycdrvb<n> block devices
+static DEFINE_XARRAY_ALLOC(mycdrv_devices); // device number -> asp_mycdev, the entry holds a reference
+static DEFINE_MUTEX(mycdrv_devices_lock);   // serializes adding and removing devices
+
+// latency histograms have one bucket per power of two nanoseconds, the last one collects the rest
+#define MYCDRV_HIST_BUCKETS 32
+
+// huge page backing allocates an aligned PMD sized run of pages at once, capped by what the buddy allocator can do
+#define MYCDRV_HUGE_ORDER min_t(unsigned int, PMD_SHIFT - PAGE_SHIFT, MAX_ORDER - 1)
+#define MYCDRV_HUGE_PAGES (1UL << MYCDRV_HUGE_ORDER)
+#define MYCDRV_HUGE_SIZE (MYCDRV_HUGE_PAGES << PAGE_SHIFT)
+
+// ASP_PERSIST and ASP_RESTORE move up to this many pages per call into the backing file
+#define MYCDRV_PERSIST_PAGES 256
+
+// per-cpu usage counters of a device, summed up when they are read through debugfs
+struct mycdrv_stats
+{
+    u64 rd_ops;
+    u64 rd_bytes;
+    u64 wr_ops;
+    u64 wr_bytes;
+    u64 seeks;
+    u64 grows;
+    u64 lock_wait_ns;
+    u64 compressions;
+    u64 decompressions;
+    u64 decompress_ns;
+    u64 huge_allocs;
+    u64 huge_fallbacks;
+    u64 crc_mismatches; // pages found not to match their checksum, by reads and scrubs
+    u64 crc_scrubbed;   // pages verified by ASP_SCRUB
+    u64 rd_hist[MYCDRV_HIST_BUCKETS];
+    u64 wr_hist[MYCDRV_HIST_BUCKETS];
+};
+
+// a compressed page, stored in the page index as a pointer tagged with MYCDRV_ZPAGE_TAG
+struct mycdrv_zpage
+{
+    unsigned int len;
+    u8 data[];
+};
+#define MYCDRV_ZPAGE_TAG 1
+#define MYCDRV_COMPRESSOR "lzo"
+
+// marks a checksum the page matched when it was last verified, cleared when the checksum is recomputed
+#define MYCDRV_CRC_VERIFIED XA_MARK_0
 
+// a written log record waiting on log_recs for the records in front of it to be written
+struct mycdrv_log_rec
+{
+    struct list_head node;
+    s64 start;
+    s64 end;
+};
 
 typedef struct asp_mycdev
 {
-    struct cdev cdev;
-    char *ramdisk;
+    struct cdev *cdev;
+    struct kref ref; // held by the device table and by every open file
+    struct xarray pages; // sparse page index of the ramdisk, pages are allocated on first write
     size_t ram_size;
-    int counter;
-    struct semaphore sem;
-    int buf_size;
+    atomic_t counter;
+    struct rw_semaphore sem; // reads and writes share the device, growth, clearing and mode changes are exclusive
+    // byte range locks of the reads and writes holding the shared lock, only overlapping ranges wait
+    spinlock_t range_lock;
+    struct list_head ranges;
+    wait_queue_head_t rangeq;
+    spinlock_t size_lock; // protects buf_size against updates from the mmap write fault path
+    loff_t buf_size;
     int dev_num;
+    struct address_space *mapping; // set once the device has been mmapped, used to zap user mappings
+    struct mycdrv_stats __percpu *stats;
+    struct dentry *debugfs; // /sys/kernel/debug/mycdrv/mycdrv<dev_num>
+    int mode; // MYCDRV_MODE_*, changed only under the exclusive lock
+    // FIFO mode: free-running byte counters of the stream, the ramdisk holds tail - head bytes
+    u64 fifo_head;
+    u64 fifo_tail;
+    wait_queue_head_t readq;  // readers waiting for data
+    wait_queue_head_t writeq; // writers waiting for space
+    // log mode: bytes reserved by appenders and the end of the records that are completely written,
+    // readers stop at log_committed. Both are reset under the exclusive lock.
+    atomic64_t log_tail;
+    atomic64_t log_committed;
+    spinlock_t log_lock; // queues and commits records, reserving space is a cmpxchg on log_tail
+    struct list_head log_recs; // written records sorted by start, empty whenever the exclusive lock is held
+    wait_queue_head_t commitq; // appenders waiting for the records in front of theirs to commit
+    struct page *ring_page; // ring mode control page, set and cleared under the exclusive lock and the xa_lock
+    int node; // NUMA placement of new pages: a node id, NUMA_NO_NODE or MYCDRV_NODE_INTERLEAVE
+    // cold page compression: zlock serializes the compressor and protects the compressed entries
+    struct mutex zlock;
+    struct crypto_comp *tfm; // allocated when compression is first enabled
+    u8 *zbuf;                // compressor output buffer
+    unsigned int compress_interval;
+    struct delayed_work compress_work;
+    atomic_long_t zpages;    // pages held compressed
+    atomic_long_t zbytes;    // bytes they take compressed
+    // optional block device frontend /dev/mycdrvb<n>
+    struct gendisk *disk;
+    struct blk_mq_tag_set tag_set;
+    bool huge; // pages are allocated in aligned runs of MYCDRV_HUGE_PAGES, the size grows by whole runs
+    bool readonly; // a snapshot, its pages are shared with the device it was taken of and never change
+    // integrity mode: page index -> crc32c of the page as an xa_mk_value entry, verified on read. Pages
+    // without an entry aren't checked, that includes the holes and the pages mapped into user space.
+    bool integrity;
+    struct xarray crcs;
 } asp_mycdev;
-asp_mycdev *device_nodes; // struct pointer to the devices.
 
 static int mycdrv_open(struct inode *inode, struct file *file);
 static int mycdrv_release(struct inode *inode, struct file *file);
-static ssize_t mycdrv_read(struct file *file, char __user *buf, size_t lbuf, loff_t *ppos);
-static ssize_t mycdrv_write(struct file *file, const char __user *buf, size_t lbuf, loff_t *ppos);
+static ssize_t mycdrv_read_iter(struct kiocb *iocb, struct iov_iter *to);
+static ssize_t mycdrv_write_iter(struct kiocb *iocb, struct iov_iter *from);
 static loff_t mycdrv_llseek(struct file *filp, loff_t offset, int parameter);
 static long mycdrv_ioctl(struct file *filp, unsigned int cmd, unsigned long direction);
+static int mycdrv_mmap(struct file *file, struct vm_area_struct *vma);
+static ssize_t mycdrv_splice_read(struct file *in, loff_t *ppos, struct pipe_inode_info *pipe, size_t len, unsigned int flags);
+static long mycdrv_do_zero_range(asp_mycdev *d_struct_ptr, u64 offset, u64 len, bool punch, bool killable);
+static __poll_t mycdrv_poll(struct file *file, poll_table *wait);
 static int __init my_init(void);
 static void __exit my_exit(void);
+// run and tear down the KUnit suite of mycdrv_kunit.c when it is built in, no-ops otherwise
+static void mycdrv_kunit_init(void);
+static void mycdrv_kunit_exit(void);
 
 static const struct file_operations mycdrv_fops =
     {
         .owner = THIS_MODULE,
-        .read = mycdrv_read,
-        .write = mycdrv_write,
+        .read_iter = mycdrv_read_iter,
+        .write_iter = mycdrv_write_iter,
         .open = mycdrv_open,
         .release = mycdrv_release,
         .llseek = mycdrv_llseek,
         .unlocked_ioctl = mycdrv_ioctl,
+        .mmap = mycdrv_mmap,
+        .poll = mycdrv_poll,
+        // splice, sendfile and friends move pages through read_iter/write_iter without a user copy
+        .splice_read = mycdrv_splice_read,
+        .splice_write = iter_file_splice_write,
 };
 
-// module parameters -
-module_param(NUM_DEVICES, int, S_IRUGO);
-static int __init my_init(void)
+// node a new page of the device is allocated on.
+static int mycdrv_page_node(asp_mycdev *dev, pgoff_t index)
 {
-    unsigned int first_minor_num = 0; // first minor number starts with 0
-    int err, i;
+    int node = READ_ONCE(dev->node);
+    int nth, nid;
 
-    // get range of minor numbers and dynamic major number.
-    if (alloc_chrdev_region(&maj_min, first_minor_num, NUM_DEVICES, DEVICE_NAME) != 0)
+    if (node != MYCDRV_NODE_INTERLEAVE)
+        return node;
+    // interleave by page index, so a device's layout doesn't depend on the order it is written in
+    nth = index % num_online_nodes();
+    for_each_online_node(nid)
     {
-        pr_info("INIT ERROR (mycdrv): Could not create major number dynamically.\n");
-        return -1;
+        if (nth-- == 0)
+            return nid;
     }
-    major_num = MAJOR(maj_min);
-    // create class device nodes
-    if ((mycdrv_class = class_create(THIS_MODULE, DEVICE_NAME)) == NULL)
+    return NUMA_NO_NODE;
+}
+
+static bool mycdrv_is_zpage(void *entry)
+{
+    return xa_pointer_tag(entry) == MYCDRV_ZPAGE_TAG;
+}
+
+// free a compressed entry that has been removed from the index, called under zlock.
+static void mycdrv_free_zpage(asp_mycdev *dev, void *entry)
+{
+    struct mycdrv_zpage *zpage = xa_untag_pointer(entry);
+
+    atomic_long_dec(&dev->zpages);
+    atomic_long_sub(zpage->len, &dev->zbytes);
+    kfree(zpage);
+}
+
+// decompress the compressed entry of index into page, called under zlock.
+static int mycdrv_unpack_zpage(asp_mycdev *dev, pgoff_t index, void *entry, struct page *page)
+{
+    struct mycdrv_zpage *zpage = xa_untag_pointer(entry);
+    unsigned int len = PAGE_SIZE;
+    void *addr;
+    int err;
+
+    addr = kmap_local_page(page);
+    err = crypto_comp_decompress(dev->tfm, zpage->data, zpage->len, addr, &len);
+    kunmap_local(addr);
+    if (err || len != PAGE_SIZE)
     {
-        pr_info("INIT ERROR (mycdrv): Class creation failed.\n");
-        return -1;
+        pr_err("mycdrv%d: corrupt compressed page %lu\n", dev->dev_num, index);
+        return -EIO;
     }
+    return 0;
+}
+
+// bring a compressed page back into memory, returns whatever the index holds afterwards.
+static struct page *mycdrv_decompress_page(asp_mycdev *dev, pgoff_t index)
+{
+    struct page *page;
+    u64 start = ktime_get_ns();
+    void *entry;
+    int err;
 
-    // allocate space for the device nodes.
-    device_nodes = (asp_mycdev *)kmalloc(NUM_DEVICES * sizeof(asp_mycdev), GFP_KERNEL);
-    memset(device_nodes, 0, NUM_DEVICES * sizeof(struct asp_mycdev));
-    // allocate ramdisk space and create device nodes for total number of devices (init all cdevs)
+    page = alloc_pages_node(mycdrv_page_node(dev, index), GFP_KERNEL, 0);
+    if (!page)
+        return ERR_PTR(-ENOMEM);
 
-    for (i = 0; i < NUM_DEVICES; i++)
+    mutex_lock(&dev->zlock);
+    entry = xa_load(&dev->pages, index);
+    if (!mycdrv_is_zpage(entry))
+    {
+        // decompressed by somebody else or punched out while we allocated
+        mutex_unlock(&dev->zlock);
+        __free_page(page);
+        return entry;
+    }
+    err = mycdrv_unpack_zpage(dev, index, entry, page);
+    if (err)
     {
+        mutex_unlock(&dev->zlock);
+        __free_page(page);
+        return ERR_PTR(err);
+    }
+    // replacing a present entry doesn't allocate
+    xa_store(&dev->pages, index, page, GFP_KERNEL);
+    mycdrv_free_zpage(dev, entry);
+    mutex_unlock(&dev->zlock);
 
-        // create a device  number with major and minor(i) numbers
-        dev_t device_Id = MKDEV(major_num, i);
-        asp_mycdev *dev = &device_nodes[i];
+    this_cpu_inc(dev->stats->decompressions);
+    this_cpu_add(dev->stats->decompress_ns, ktime_get_ns() - start);
+    return page;
+}
 
-        // initialize the custom cdev struct members
-        cdev_init(&dev->cdev, &mycdrv_fops);
-        dev->cdev.owner = THIS_MODULE;
-        // add character device to the system VFS
-        err = cdev_add(&dev->cdev, device_Id, 1);
-        if (err)
-        {
-            pr_err("INIT Error %d adding device node %d", err, i);
-        }
-        dev->ram_size = ramdisk_size;
-        dev->counter = 0;
-        dev->dev_num = i;
-        dev->buf_size =0;
-        dev->ramdisk = (char *)kzalloc(ramdisk_size, GFP_KERNEL);
-        sema_init(&dev->sem, 1); // binary semaphore
-        device_create(mycdrv_class, NULL, device_Id, NULL, DEVICE_NAME "%d", i);
+// populate the holes of the aligned run holding index from one high order allocation. The run is split
+// into ordinary pages, so everything else still deals in single pages. False if memory is too fragmented.
+static bool mycdrv_fill_huge(asp_mycdev *dev, pgoff_t index)
+{
+    pgoff_t first = round_down(index, MYCDRV_HUGE_PAGES);
+    struct page *page;
+    unsigned long i;
+    void *old;
 
-        pr_info("INIT: Succesfully registered character device %s%d\n", DEVICE_NAME, i);
+    if ((loff_t)(first + MYCDRV_HUGE_PAGES) << PAGE_SHIFT > READ_ONCE(dev->ram_size))
+        return false;
+    // don't stall on compaction, single pages are the fallback
+    page = alloc_pages_node(mycdrv_page_node(dev, first), GFP_KERNEL | __GFP_ZERO | __GFP_NOWARN | __GFP_NORETRY,
+                            MYCDRV_HUGE_ORDER);
+    if (!page)
+    {
+        this_cpu_inc(dev->stats->huge_fallbacks);
+        return false;
     }
-    return 0;
+    split_page(page, MYCDRV_HUGE_ORDER);
+    this_cpu_inc(dev->stats->huge_allocs);
+    for (i = 0; i < MYCDRV_HUGE_PAGES; i++)
+    {
+        // slots that are already populated keep their page
+        old = xa_cmpxchg(&dev->pages, first + i, NULL, page + i, GFP_KERNEL);
+        if (old)
+            __free_page(page + i);
+    }
+    // zero page mappings of the filled holes, as in mycdrv_get_page
+    smp_mb();
+    if (dev->mapping)
+        unmap_mapping_range(dev->mapping, (loff_t)first << PAGE_SHIFT, (loff_t)MYCDRV_HUGE_PAGES << PAGE_SHIFT, 0);
+    return true;
 }
 
-static int mycdrv_open(struct inode *inode, struct file *file)
+static u32 mycdrv_crc_page(struct page *page)
 {
-    // static int counter = 0;
-    asp_mycdev *d_struct_ptr;
-    pr_info("OPEN: Opening Device: %s:\n", DEVICE_NAME);
+    void *addr = kmap_local_page(page);
+    u32 crc = crc32c(~0, addr, PAGE_SIZE);
 
-    // get pointer to the struct data
-    d_struct_ptr = container_of(inode->i_cdev, struct asp_mycdev, cdev);
-    // store the pointer in files private data.
-    file->private_data = d_struct_ptr;
+    kunmap_local(addr);
+    return crc;
+}
 
-    if(down_interruptible(&d_struct_ptr->sem)){
-                return ERESTARTSYS;
-            }
-    // keeping track of the count
-    d_struct_ptr->counter++;
-    up(&d_struct_ptr->sem);
+// recompute the checksum of a page that was just written, called with its bytes range locked. The page
+// lock orders this against page_mkwrite, which drops the checksum of a page about to be written through
+// a mapping. A mapped page isn't checksummed at all, its contents change behind our back.
+static void mycdrv_crc_update(asp_mycdev *dev, pgoff_t index, struct page *page)
+{
+    void *old;
 
-    pr_info("OPEN: Successfully opened  %s : opened  %d times since being loaded\n", DEVICE_NAME, d_struct_ptr->counter);
-    return 0;
+    if (!dev->integrity)
+        return;
+    lock_page(page);
+    if (page_mapped(page))
+        xa_erase(&dev->crcs, index);
+    else
+    {
+        old = xa_store(&dev->crcs, index, xa_mk_value(mycdrv_crc_page(page)), GFP_KERNEL);
+        // better no checksum than a stale one. Storing keeps the marks of the old checksum.
+        if (xa_is_err(old))
+            xa_erase(&dev->crcs, index);
+        else if (xa_get_mark(&dev->crcs, index, MYCDRV_CRC_VERIFIED))
+            xa_clear_mark(&dev->crcs, index, MYCDRV_CRC_VERIFIED);
+    }
+    unlock_page(page);
 }
 
-static int mycdrv_release(struct inode *inode, struct file *file)
+// false if the page doesn't match its checksum, called with its bytes range locked. Reads only check a
+// page once after it is written, force recomputes the checksum anyway and is what ASP_SCRUB uses.
+static bool mycdrv_crc_verify(asp_mycdev *dev, pgoff_t index, struct page *page, bool force)
 {
-    asp_mycdev *d_struct_ptr;
-    pr_info("CLOSE: Closing Device: %s:\n", DEVICE_NAME);
+    void *entry = xa_load(&dev->crcs, index);
 
-    // get pointer to the struct data
-    d_struct_ptr = container_of(inode->i_cdev, struct asp_mycdev, cdev);
-    // store the pointer in files private data.
-    file->private_data = d_struct_ptr;
-    if(down_interruptible(&d_struct_ptr->sem)){
-                return ERESTARTSYS;
-            }
-    // decrement count when device closes
-    d_struct_ptr->counter--;
-    up(&d_struct_ptr->sem);
+    if (!entry || (!force && xa_get_mark(&dev->crcs, index, MYCDRV_CRC_VERIFIED)))
+        return true;
+    if (mycdrv_crc_page(page) == xa_to_value(entry))
+    {
+        xa_set_mark(&dev->crcs, index, MYCDRV_CRC_VERIFIED);
+        return true;
+    }
+    // a write through a mapping drops the checksum before it changes the page
+    if (xa_load(&dev->crcs, index) != entry)
+        return true;
+    xa_clear_mark(&dev->crcs, index, MYCDRV_CRC_VERIFIED);
+    this_cpu_inc(dev->stats->crc_mismatches);
+    pr_err_ratelimited("mycdrv%d: checksum mismatch in page %lu\n", dev->dev_num, index);
+    return false;
+}
 
-    pr_info("CLOSE: Successfully Closed  %s .\n", DEVICE_NAME);
-    return 0;
+// the page store and byte range locks, shared with the user space build
+#include "mycdrv_core.c"
+
+// release every populated page of the device, the whole ramdisk becomes a hole.
+static void mycdrv_free_pages(asp_mycdev *dev)
+{
+    void *entry;
+    unsigned long index;
+
+    // a fault may be decompressing concurrently
+    mutex_lock(&dev->zlock);
+    xa_for_each(&dev->pages, index, entry)
+    {
+        xa_erase(&dev->pages, index);
+        if (mycdrv_is_zpage(entry))
+            mycdrv_free_zpage(dev, entry);
+        // the page state of a shared page belongs to the writable device
+        else if (dev->readonly)
+            put_page(entry);
+        else
+            mycdrv_release_page(entry);
+    }
+    mutex_unlock(&dev->zlock);
+    xa_destroy(&dev->crcs);
+    // user mappings still point at the released pages, the next access faults in fresh ones
+    if (dev->mapping)
+        unmap_mapping_range(dev->mapping, 0, 0, 1);
 }
-// module init
-module_init(my_init);
 
-static ssize_t
-mycdrv_read(struct file *file, char __user *buf, size_t lbuf, loff_t *ppos)
+// take a reference on the ring control page, NULL if the device isn't in ring mode.
+static struct page *mycdrv_ring_get(asp_mycdev *dev)
 {
-    int nbytes = 0;
-    asp_mycdev *d_struct_ptr;
+    struct page *page;
 
-    d_struct_ptr = (asp_mycdev *)file->private_data;
+    xa_lock(&dev->pages);
+    page = dev->ring_page;
+    if (page)
+        get_page(page);
+    xa_unlock(&dev->pages);
+    return page;
+}
 
-    if(down_interruptible(&d_struct_ptr->sem)){
-                return ERESTARTSYS;
-            }
-    // maxbytes = d_struct_ptr->ram_size - *ppos;
-    // bytes_to_do = maxbytes > lbuf ? lbuf : maxbytes;
-    if ((lbuf + *ppos) > d_struct_ptr->ram_size)
-    {
-        pr_info("READ: !!!! ALERT !!!!!\n");
-        pr_info("READ: End of the device\n");
-        pr_info("READ: lbuf + *ppos , d_struct_ptr->ram_size= %d + %d , %d\n", (int)lbuf, (int)*ppos, (int)d_struct_ptr->ram_size);
-        up(&d_struct_ptr->sem);
-        return 0;
+// install or remove the ring control page, the old one is released. Called under the exclusive lock.
+static void mycdrv_ring_set(asp_mycdev *dev, struct page *page)
+{
+    struct page *old;
+
+    xa_lock(&dev->pages);
+    old = dev->ring_page;
+    dev->ring_page = page;
+    xa_unlock(&dev->pages);
+    if (old)
+        mycdrv_release_page(old);
+}
+
+// true if copying len bytes at pos can't sleep: no page is compressed and, for a write, none has to be
+// allocated or copied away from a snapshot.
+// Called with the range locked, so the answer holds until the copy is done.
+static bool mycdrv_range_resident(asp_mycdev *dev, loff_t pos, size_t len, bool write)
+{
+    pgoff_t index, last;
+    void *entry;
+
+    if (!len)
+        return true;
+    last = (pos + len - 1) >> PAGE_SHIFT;
+    for (index = pos >> PAGE_SHIFT; index <= last; index++)
+    {
+        entry = xa_load(&dev->pages, index);
+        if (mycdrv_is_zpage(entry) || (write && (!entry || xa_get_mark(&dev->pages, index, MYCDRV_SHARED))))
+            return false;
     }
-    nbytes = lbuf - copy_to_user(buf, d_struct_ptr->ramdisk + *ppos, lbuf);
-    *ppos += nbytes;
-    up(&d_struct_ptr->sem);
+    return true;
+}
 
-    pr_info("\n READ: Read succesfull, nbytes=%d, pos=%d\n", nbytes, (int)*ppos);
-    return nbytes;
+// growing the device adds a page, or a whole run for huge page backed devices.
+static size_t mycdrv_grow_step(asp_mycdev *dev)
+{
+    return dev->huge ? MYCDRV_HUGE_SIZE : PAGE_SIZE;
 }
 
-static ssize_t mycdrv_write(struct file *file, const char __user *buf, size_t lbuf, loff_t *ppos)
+static unsigned long mycdrv_count_crcs(asp_mycdev *dev)
 {
-    int nbytes = 0;
-    asp_mycdev *d_struct_ptr;
-    d_struct_ptr = (asp_mycdev *)file->private_data;
-    pr_info("WRITE: at starting *ppos = %d, file->f_pos = %d \n", (int)*ppos, (int)file->f_pos);
-    if(down_interruptible(&d_struct_ptr->sem)){
-                return ERESTARTSYS;
-            }
-    // check if the user is trying to write past end of the device
-    if ((lbuf + *ppos) > d_struct_ptr->ram_size)
+    unsigned long index, count = 0;
+    void *entry;
+
+    xa_for_each(&dev->crcs, index, entry)
+        count++;
+    return count;
+}
+
+static unsigned int mycdrv_hist_bucket(u64 ns)
+{
+    return ns ? min_t(unsigned int, ilog2(ns), MYCDRV_HIST_BUCKETS - 1) : 0;
+}
+
+// timestamps of one read or write. The clock is only read for a consumer of the time: the latency
+// stats when latency_stats is set, or the tracepoint of the I/O when it is enabled.
+struct mycdrv_clock
+{
+    bool stats; // latency_stats was set when the I/O started
+    u64 start;  // 0 when the I/O isn't timed
+    u64 locked;
+};
+
+static void mycdrv_clock_start(struct mycdrv_clock *clk, bool traced)
+{
+    clk->stats = READ_ONCE(latency_stats);
+    clk->start = clk->stats || traced ? ktime_get_ns() : 0;
+    clk->locked = clk->start;
+}
+
+// the I/O holds its locks, the time until now counts as lock wait
+static void mycdrv_clock_locked(struct mycdrv_clock *clk)
+{
+    if (clk->stats)
+        clk->locked = ktime_get_ns();
+}
+
+// account a finished read or write, returns its latency for the tracepoint or 0 if it wasn't timed.
+// The latency covers the lock wait and the copy.
+static u64 mycdrv_account_io(asp_mycdev *dev, bool write, ssize_t nbytes, const struct mycdrv_clock *clk)
+{
+    u64 latency_ns = clk->start ? ktime_get_ns() - clk->start : 0;
+    struct mycdrv_stats *stats = get_cpu_ptr(dev->stats);
+
+    if (clk->stats)
+        stats->lock_wait_ns += clk->locked - clk->start;
+    if (write)
+    {
+        stats->wr_ops++;
+        stats->wr_bytes += nbytes > 0 ? nbytes : 0;
+        if (clk->stats)
+            stats->wr_hist[mycdrv_hist_bucket(latency_ns)]++;
+    }
+    else
     {
-        pr_info("WRITE: !!!! ALERT !!!!! \n");
-        pr_info("WRITE: End of the device\n");
-        pr_info("WRITE: lbuf + *ppos , d_struct_ptr->ram_size= %d + %d , %d\n", (int)lbuf, (int)*ppos, (int)d_struct_ptr->ram_size);
+        stats->rd_ops++;
+        stats->rd_bytes += nbytes > 0 ? nbytes : 0;
+        if (clk->stats)
+            stats->rd_hist[mycdrv_hist_bucket(latency_ns)]++;
+    }
+    put_cpu_ptr(dev->stats);
+    return latency_ns;
+}
 
-        return 0;
+static void mycdrv_stats_show_hist(struct seq_file *m, const char *name, const u64 *hist)
+{
+    int b;
+
+    seq_printf(m, "%s:\n", name);
+    for (b = 0; b < MYCDRV_HIST_BUCKETS; b++)
+    {
+        if (hist[b])
+            seq_printf(m, "    %llu: %llu\n", 1ULL << b, hist[b]);
     }
+}
 
-    // copy data from user space into kernel space
-    nbytes = lbuf - copy_from_user(d_struct_ptr->ramdisk + *ppos, buf, lbuf);
-    if(nbytes + *ppos > d_struct_ptr->buf_size){
-        d_struct_ptr->buf_size = nbytes- ( d_struct_ptr->buf_size - *ppos);
+// debugfs stats: the per-cpu counters summed over all cpus, histogram buckets are keyed by their lower bound.
+static int mycdrv_stats_show(struct seq_file *m, void *v)
+{
+    asp_mycdev *dev = m->private;
+    struct mycdrv_stats *sum;
+    long zpages, zbytes;
+    int cpu, b;
+
+    sum = kzalloc(sizeof(*sum), GFP_KERNEL);
+    if (!sum)
+        return -ENOMEM;
+    for_each_possible_cpu(cpu)
+    {
+        struct mycdrv_stats *stats = per_cpu_ptr(dev->stats, cpu);
+
+        sum->rd_ops += stats->rd_ops;
+        sum->rd_bytes += stats->rd_bytes;
+        sum->wr_ops += stats->wr_ops;
+        sum->wr_bytes += stats->wr_bytes;
+        sum->seeks += stats->seeks;
+        sum->grows += stats->grows;
+        sum->lock_wait_ns += stats->lock_wait_ns;
+        sum->compressions += stats->compressions;
+        sum->decompressions += stats->decompressions;
+        sum->decompress_ns += stats->decompress_ns;
+        sum->huge_allocs += stats->huge_allocs;
+        sum->huge_fallbacks += stats->huge_fallbacks;
+        sum->crc_mismatches += stats->crc_mismatches;
+        sum->crc_scrubbed += stats->crc_scrubbed;
+        for (b = 0; b < MYCDRV_HIST_BUCKETS; b++)
+        {
+            sum->rd_hist[b] += stats->rd_hist[b];
+            sum->wr_hist[b] += stats->wr_hist[b];
+        }
     }
-    //d_struct_ptr->buf_size = nbytes;
-    *ppos += nbytes;
-    file->f_pos = *ppos;
-    up(&d_struct_ptr->sem);
 
-    pr_info("WRITE: Write succesfull, nbytes=%d, pos=%d\n", nbytes, (int)*ppos);
-    return nbytes;
+    seq_printf(m, "read_ops: %llu\n", sum->rd_ops);
+    seq_printf(m, "read_bytes: %llu\n", sum->rd_bytes);
+    seq_printf(m, "write_ops: %llu\n", sum->wr_ops);
+    seq_printf(m, "write_bytes: %llu\n", sum->wr_bytes);
+    seq_printf(m, "seeks: %llu\n", sum->seeks);
+    seq_printf(m, "grows: %llu\n", sum->grows);
+    seq_printf(m, "lock_wait_ns: %llu\n", sum->lock_wait_ns);
+    zpages = atomic_long_read(&dev->zpages);
+    zbytes = atomic_long_read(&dev->zbytes);
+    seq_printf(m, "compressed_pages: %ld\n", zpages);
+    seq_printf(m, "compressed_bytes: %ld\n", zbytes);
+    // uncompressed size per compressed byte, in hundredths
+    seq_printf(m, "compression_ratio_pct: %ld\n", zbytes ? zpages * PAGE_SIZE * 100 / zbytes : 0);
+    seq_printf(m, "compressions: %llu\n", sum->compressions);
+    seq_printf(m, "decompressions: %llu\n", sum->decompressions);
+    seq_printf(m, "decompress_avg_ns: %llu\n", sum->decompressions ? div64_u64(sum->decompress_ns, sum->decompressions) : 0);
+    seq_printf(m, "huge_allocs: %llu\n", sum->huge_allocs);
+    seq_printf(m, "huge_fallbacks: %llu\n", sum->huge_fallbacks);
+    seq_printf(m, "crc_pages: %lu\n", dev->integrity ? mycdrv_count_crcs(dev) : 0);
+    seq_printf(m, "crc_mismatches: %llu\n", sum->crc_mismatches);
+    seq_printf(m, "crc_scrubbed: %llu\n", sum->crc_scrubbed);
+    mycdrv_stats_show_hist(m, "read_latency_ns", sum->rd_hist);
+    mycdrv_stats_show_hist(m, "write_latency_ns", sum->wr_hist);
+    kfree(sum);
+    return 0;
 }
+DEFINE_SHOW_ATTRIBUTE(mycdrv_stats);
 
-static loff_t mycdrv_llseek(struct file *file, loff_t offset, int parameter)
+// any write to the reset file zeroes the counters, updates racing with the reset may survive it.
+static ssize_t mycdrv_reset_write(struct file *file, const char __user *buf, size_t count, loff_t *ppos)
 {
-    loff_t temppos;
-    int flag =0;
-    size_t current_size, new_size;
-    int i;
-    asp_mycdev *d_struct_ptr;
-    char *temp_ramdisk;
-    d_struct_ptr = (asp_mycdev *)file->private_data;
-    if(down_interruptible(&d_struct_ptr->sem)){
-                return ERESTARTSYS;
-            }
-    switch (parameter)
+    asp_mycdev *dev = file->private_data;
+    int cpu;
+
+    for_each_possible_cpu(cpu)
+        memset(per_cpu_ptr(dev->stats, cpu), 0, sizeof(struct mycdrv_stats));
+    return count;
+}
+
+static const struct file_operations mycdrv_reset_fops =
     {
-    case SEEK_SET:
-        temppos = offset;
-        break;
-    case SEEK_CUR:
-        temppos = file->f_pos + offset;
-        break;
-    case SEEK_END://setting the SEEK_END to the end of the data.
-        flag=1;
-        if(!(d_struct_ptr->buf_size>= 0)){
-            d_struct_ptr->buf_size=0;
-        }
-        temppos = (d_struct_ptr->buf_size) + (offset);
-        break;
-    default:
+        .owner = THIS_MODULE,
+        .open = simple_open,
+        .write = mycdrv_reset_write,
+        .llseek = noop_llseek,
+};
+
+static bool mycdrv_node_valid(int node)
+{
+    return node == NUMA_NO_NODE || node == MYCDRV_NODE_INTERLEAVE ||
+           (node >= 0 && node < nr_node_ids && node_online(node));
+}
+
+// parse a node policy: "local", "interleave" or an online node id.
+static int mycdrv_parse_node(const char *buf, int *node)
+{
+    int nid;
+
+    if (sysfs_streq(buf, "local"))
+        *node = NUMA_NO_NODE;
+    else if (sysfs_streq(buf, "interleave"))
+        *node = MYCDRV_NODE_INTERLEAVE;
+    else if (kstrtoint(buf, 0, &nid) || nid < 0 || !mycdrv_node_valid(nid))
         return -EINVAL;
+    else
+        *node = nid;
+    return 0;
+}
+
+// /sys/class/mycdrv/mycdrv<n>/numa_policy: placement of pages allocated from now on, present pages don't move.
+static ssize_t numa_policy_show(struct device *device, struct device_attribute *attr, char *buf)
+{
+    asp_mycdev *dev = dev_get_drvdata(device);
+    int node = READ_ONCE(dev->node);
+
+    if (node == NUMA_NO_NODE)
+        return sysfs_emit(buf, "local\n");
+    if (node == MYCDRV_NODE_INTERLEAVE)
+        return sysfs_emit(buf, "interleave\n");
+    return sysfs_emit(buf, "%d\n", node);
+}
+
+static ssize_t numa_policy_store(struct device *device, struct device_attribute *attr, const char *buf, size_t count)
+{
+    asp_mycdev *dev = dev_get_drvdata(device);
+    int node, err;
+
+    err = mycdrv_parse_node(buf, &node);
+    if (err)
+        return err;
+    WRITE_ONCE(dev->node, node);
+    return count;
+}
+static DEVICE_ATTR_RW(numa_policy);
+
+// /sys/class/mycdrv/mycdrv<n>/numa_pages: where the populated pages actually live, in numa_maps format.
+static ssize_t numa_pages_show(struct device *device, struct device_attribute *attr, char *buf)
+{
+    asp_mycdev *dev = dev_get_drvdata(device);
+    unsigned long index, *counts;
+    void *entry;
+    int nid, len = 0;
+
+    counts = kcalloc(nr_node_ids, sizeof(*counts), GFP_KERNEL);
+    if (!counts)
+        return -ENOMEM;
+    // keep ASP_CLEAR_BUF from freeing pages under the walk
+    if (down_read_interruptible(&dev->sem))
+    {
+        kfree(counts);
+        return -ERESTARTSYS;
     }
-    if (temppos > d_struct_ptr->ram_size)
+    // compressed pages live in slab memory and aren't counted
+    xa_for_each(&dev->pages, index, entry)
     {
-        // set the cursor to the end of file + offset
-        pr_info("LLSEEK: Reallocating device size.\n");
-        //file->f_pos = ramdisk_size + offset - 1;
-        current_size = d_struct_ptr->ram_size;
-        new_size = d_struct_ptr->ram_size + (1 * PAGE_SIZE);
-        pr_info("LLSEEK: Current size = %d, New_size = %d \n", (int)current_size, (int)new_size);
+        if (!mycdrv_is_zpage(entry))
+            counts[page_to_nid(entry)]++;
+    }
+    up_read(&dev->sem);
 
-        // extending the size and allocating 0's
-        if ((temp_ramdisk = (char *)kzalloc(new_size, GFP_KERNEL)) != NULL)
-        {
-            // retriving the contents of current_ramdisk to temp_ramdisk
-            for (i = 0; i < current_size; i++)
-            {
-                temp_ramdisk[i] = d_struct_ptr->ramdisk[i];
-            }
+    for_each_node_state(nid, N_MEMORY)
+        len += sysfs_emit_at(buf, len, "%sN%d=%lu", len ? " " : "", nid, counts[nid]);
+    len += sysfs_emit_at(buf, len, "\n");
+    kfree(counts);
+    return len;
+}
+static DEVICE_ATTR_RO(numa_pages);
 
-            // deallocation the original ramdisk
-            kfree(d_struct_ptr->ramdisk);
+// compress one page that hasn't been touched since the last scan, called with its range locked and a
+// reference on the page held by the caller.
+static void mycdrv_compress_page(asp_mycdev *dev, pgoff_t index, struct page *page)
+{
+    struct mycdrv_zpage *zpage;
+    unsigned int len = 2 * PAGE_SIZE;
+    void *addr, *old;
+    int err;
 
-            // assiging new ramdisk and ramsize to the device data structure
-            d_struct_ptr->ramdisk = temp_ramdisk;
-            d_struct_ptr->ram_size = new_size;
-        }
-        else
+    mutex_lock(&dev->zlock);
+    // a write through a mapping after this point dirties the page again and cancels the swap below
+    ClearPageDirty(page);
+    addr = kmap_local_page(page);
+    err = crypto_comp_compress(dev->tfm, addr, PAGE_SIZE, dev->zbuf, &len);
+    kunmap_local(addr);
+    // not worth it for data that barely compresses
+    if (err || len > PAGE_SIZE * 3 / 4)
+        goto out;
+    zpage = kmalloc(struct_size(zpage, data, len), GFP_KERNEL | __GFP_NOWARN);
+    if (!zpage)
+        goto out;
+    zpage->len = len;
+    memcpy(zpage->data, dev->zbuf, len);
+
+    // the fault path takes its page reference under the xa_lock, a mapped page is never compressed. The
+    // two references are the index's and the caller's.
+    xa_lock(&dev->pages);
+    old = NULL;
+    if (page_count(page) == 2 && !PageDirty(page))
+        old = __xa_cmpxchg(&dev->pages, index, page, xa_tag_pointer(zpage, MYCDRV_ZPAGE_TAG), GFP_ATOMIC);
+    xa_unlock(&dev->pages);
+    if (old != page)
+    {
+        kfree(zpage);
+        goto out;
+    }
+    atomic_long_inc(&dev->zpages);
+    atomic_long_add(len, &dev->zbytes);
+    this_cpu_inc(dev->stats->compressions);
+    mycdrv_release_page(page);
+out:
+    mutex_unlock(&dev->zlock);
+}
+
+// one scan over the device: pages touched since the previous scan lose their referenced bit, the others are compressed.
+static void mycdrv_compress_cold(asp_mycdev *dev)
+{
+    struct mycdrv_range range;
+    unsigned long index;
+    struct page *page;
+    void *entry;
+
+    xa_for_each(&dev->pages, index, entry)
+    {
+        if (mycdrv_is_zpage(entry))
+            continue;
+        // skip pages with a read or write in flight, they are warm anyway. The range lock also keeps hole
+        // punching and copy-on-write off the slot, but the entry of the walk may already be gone: only
+        // touch it if the slot still holds it and it can be pinned.
+        range.start = (loff_t)index << PAGE_SHIFT;
+        range.end = range.start + PAGE_SIZE;
+        range.write = true;
+        if (!mycdrv_range_trylock(dev, &range))
+            continue;
+        page = xa_load(&dev->pages, index);
+        if (page == entry && get_page_unless_zero(page))
         {
-            pr_info("LLSEEK: ERROR: Reallocattion of the memory failed.\n");
+            if (!TestClearPageReferenced(page) && page_count(page) == 2)
+                mycdrv_compress_page(dev, index, page);
+            put_page(page);
         }
+        mycdrv_range_unlock(dev, &range);
+        cond_resched();
     }
-    //temppos = temppos < d_struct_ptr->ram_size ? temppos : d_struct_ptr->ram_size;
-    temppos = temppos >= 0 ? temppos : 0;
-    // if(flag){
-    //     file->f_pos = temppos_dispose;
-    //     pr_info("Seeking end to pos=%ld\n", (long)temppos_dispose);
-
-    // }else{
-    file->f_pos = temppos;
-    
-    pr_info("LLSEEK: Seeking to position=%ld\n", (long)temppos);
-    //}
-    up(&d_struct_ptr->sem);
-    return temppos;
 }
 
-static long mycdrv_ioctl(struct file *file, unsigned int cmd, unsigned long direction)
+static void mycdrv_compress_work(struct work_struct *work)
 {
-	asp_mycdev* d_struct_ptr;
-	d_struct_ptr = (asp_mycdev*)file->private_data;
+    asp_mycdev *dev = container_of(to_delayed_work(work), asp_mycdev, compress_work);
+    unsigned int interval = READ_ONCE(dev->compress_interval);
 
-	switch(cmd)
-	{
-		case ASP_CLEAR_BUF:
-			pr_info("IOCTL: Clearing device memory.\n");
-			if(down_interruptible(&d_struct_ptr->sem)){
-                return ERESTARTSYS;
-            }
-            // Reset the device memory 
-			memset((void *) d_struct_ptr->ramdisk, 0, d_struct_ptr->ram_size);
-            //set position to 0.
-			file->f_pos = 0;
-            d_struct_ptr->buf_size = 0;
-			up(&d_struct_ptr->sem);
-			break;
-		
-		default:
-			pr_info("IOCTL: ERROR Invalid cmd flag.\n");
-			return -1;
-	}
+    if (!interval)
+        return;
+    // never hold up growth, clearing or a mode change, the next round catches up
+    if (down_read_trylock(&dev->sem))
+    {
+        if (dev->mode == MYCDRV_MODE_RANDOM)
+            mycdrv_compress_cold(dev);
+        up_read(&dev->sem);
+    }
+    schedule_delayed_work(&dev->compress_work, interval * HZ);
+}
+
+// allocate the compressor of a device, it is kept until the device is freed.
+static int mycdrv_alloc_compressor(asp_mycdev *dev)
+{
+    struct crypto_comp *tfm;
+    u8 *zbuf;
 
-	return 0;
+    if (dev->tfm)
+        return 0;
+    tfm = crypto_alloc_comp(MYCDRV_COMPRESSOR, 0, 0);
+    if (IS_ERR(tfm))
+        return PTR_ERR(tfm);
+    zbuf = kmalloc(2 * PAGE_SIZE, GFP_KERNEL);
+    if (!zbuf)
+    {
+        crypto_free_comp(tfm);
+        return -ENOMEM;
+    }
+    mutex_lock(&dev->zlock);
+    if (!dev->tfm)
+    {
+        dev->tfm = tfm;
+        dev->zbuf = zbuf;
+        tfm = NULL;
+    }
+    mutex_unlock(&dev->zlock);
+    // lost a race with another writer of the attribute
+    if (tfm)
+    {
+        crypto_free_comp(tfm);
+        kfree(zbuf);
+    }
+    return 0;
 }
 
-static void __exit my_exit(void)
+// enable, retune or disable (interval 0) cold page compression of a device.
+static int mycdrv_set_compress_interval(asp_mycdev *dev, unsigned int interval)
 {
-    int i;
-    pr_info("EXIT: Unregistering Character Device\n");
+    int err;
 
-    // deallocate each device's ramdisk, cdev, and device
-    for (i = 0; i < NUM_DEVICES; i++)
+    if (interval)
     {
-        asp_mycdev *devv = &device_nodes[i];
+        err = mycdrv_alloc_compressor(dev);
+        if (err)
+            return err;
+    }
+    WRITE_ONCE(dev->compress_interval, interval);
+    if (interval)
+        mod_delayed_work(system_wq, &dev->compress_work, interval * HZ);
+    else
+        cancel_delayed_work_sync(&dev->compress_work);
+    return 0;
+}
 
-        kfree(devv->ramdisk);
-        pr_info("EXIT: Free ramdisk for device %d\n", i);
+// /sys/class/mycdrv/mycdrv<n>/compress_interval: seconds untouched before a page is compressed, 0 turns it off.
+// Compressed pages stay compressed until they are accessed again.
+static ssize_t compress_interval_show(struct device *device, struct device_attribute *attr, char *buf)
+{
+    asp_mycdev *dev = dev_get_drvdata(device);
 
-        device_destroy(mycdrv_class, MKDEV(major_num, i));
-        pr_info("EXIT:  Destroyed device node %d\n", i);
+    return sysfs_emit(buf, "%u\n", READ_ONCE(dev->compress_interval));
+}
 
-        cdev_del(&devv->cdev);
-        pr_info("EXIT:  Deleted cdev for device %d\n", i);
+static ssize_t compress_interval_store(struct device *device, struct device_attribute *attr, const char *buf, size_t count)
+{
+    asp_mycdev *dev = dev_get_drvdata(device);
+    unsigned int interval;
+    int err;
 
-        //sema_destroy(&devv->sem);
-        //pr_info("EXIT:  Deleted Semaphore for device %d\n", i);
-    }
+    err = kstrtouint(buf, 0, &interval);
+    if (err)
+        return err;
+    err = mycdrv_set_compress_interval(dev, interval);
+    return err ? err : count;
+}
+static DEVICE_ATTR_RW(compress_interval);
 
-    kfree(device_nodes);
-    pr_info("EXIT: Deallocated devices\n");
+static struct attribute *mycdrv_attrs[] = {
+    &dev_attr_numa_policy.attr,
+    &dev_attr_numa_pages.attr,
+    &dev_attr_compress_interval.attr,
+    NULL,
+};
+ATTRIBUTE_GROUPS(mycdrv);
 
-    class_destroy(mycdrv_class);
-    pr_info("EXIT: Destroyed class blueprint\n");
+// map the control page of a ring mode device.
+static vm_fault_t mycdrv_ring_fault(struct vm_fault *vmf, asp_mycdev *d_struct_ptr)
+{
+    struct page *page = mycdrv_ring_get(d_struct_ptr);
 
-    unregister_chrdev_region(maj_min, NUM_DEVICES);
-    pr_info("EXIT: Unregistered device regions\n");
+    if (!page)
+        return VM_FAULT_SIGBUS;
+    lock_page(page);
+    // switched out of ring mode while we were locking
+    if (READ_ONCE(d_struct_ptr->ring_page) != page)
+    {
+        unlock_page(page);
+        put_page(page);
+        return VM_FAULT_NOPAGE;
+    }
+    page->index = vmf->pgoff;
+    vmf->page = page;
+    return VM_FAULT_LOCKED;
 }
 
-// module exit
-module_exit(my_exit);
+// map the zero page read-only over a hole. Whoever populates the hole zaps it again, the recheck covers
+// a page that went in before our pte did. A ring's holes aren't zapped at their offset, ring mode
+// allocates instead.
+static vm_fault_t mycdrv_zero_fault(struct vm_fault *vmf, asp_mycdev *d_struct_ptr, pgoff_t index)
+{
+    vm_fault_t ret;
+
+    ret = vmf_insert_mixed(vmf->vma, vmf->address, pfn_to_pfn_t(my_zero_pfn(vmf->address)));
+    if (ret != VM_FAULT_NOPAGE)
+        return ret;
+    // pairs with the barrier after populating a hole
+    smp_mb();
+    if (xa_load(&d_struct_ptr->pages, index) || READ_ONCE(d_struct_ptr->mode) == MYCDRV_MODE_RING)
+        unmap_mapping_range(vmf->vma->vm_file->f_mapping, (loff_t)vmf->pgoff << PAGE_SHIFT, PAGE_SIZE, 0);
+    return VM_FAULT_NOPAGE;
+}
+
+static vm_fault_t mycdrv_vm_fault(struct vm_fault *vmf)
+{
+    asp_mycdev *d_struct_ptr = vmf->vma->vm_private_data;
+    pgoff_t index = vmf->pgoff;
+    bool ring = READ_ONCE(d_struct_ptr->mode) == MYCDRV_MODE_RING;
+    struct page *page;
+
+    if (ring)
+    {
+        // ring mode puts the control page in front of the data
+        if (index == 0)
+            return mycdrv_ring_fault(vmf, d_struct_ptr);
+        index--;
+    }
+    if (((loff_t)index << PAGE_SHIFT) >= READ_ONCE(d_struct_ptr->ram_size))
+        return VM_FAULT_SIGBUS;
+
+    // only writes allocate, a read of a hole maps the zero page
+    if ((vmf->flags & FAULT_FLAG_WRITE) || ring)
+        page = mycdrv_get_page(d_struct_ptr, index);
+    else
+    {
+        page = mycdrv_lookup_page(d_struct_ptr, index);
+        if (IS_ERR(page))
+            return vmf_error(PTR_ERR(page));
+        if (!page)
+            return mycdrv_zero_fault(vmf, d_struct_ptr, index);
+    }
+    if (!page)
+        return VM_FAULT_OOM;
+
+    // the page may be released by ASP_CLEAR_BUF concurrently, take our reference under the index lock
+    xa_lock(&d_struct_ptr->pages);
+    if (xa_load(&d_struct_ptr->pages, index) != page)
+        page = NULL;
+    else
+        get_page(page);
+    xa_unlock(&d_struct_ptr->pages);
+    if (!page)
+        return VM_FAULT_NOPAGE; // retry the fault against the new page
+
+    lock_page(page);
+    if (xa_load(&d_struct_ptr->pages, index) != page)
+    {
+        unlock_page(page);
+        put_page(page);
+        return VM_FAULT_NOPAGE;
+    }
+    // page->mapping stays NULL, the pages belong to the device and not to the inode that maps them.
+    // Dirtying such a page only sets the flag, there is nothing to write it back to.
+    page->index = vmf->pgoff;
+    vmf->page = page;
+    return VM_FAULT_LOCKED;
+}
+
+// first write to a mapped page, extend buf_size so SEEK_END covers data written through the mapping.
+static vm_fault_t mycdrv_vm_page_mkwrite(struct vm_fault *vmf)
+{
+    asp_mycdev *d_struct_ptr = vmf->vma->vm_private_data;
+    struct page *page = vmf->page;
+    bool ring = READ_ONCE(d_struct_ptr->mode) == MYCDRV_MODE_RING;
+    pgoff_t index = ring ? vmf->pgoff - 1 : vmf->pgoff;
+    loff_t end = min_t(loff_t, ((loff_t)index + 1) << PAGE_SHIFT, READ_ONCE(d_struct_ptr->ram_size));
+
+    lock_page(page);
+    // released by ASP_CLEAR_BUF, a mode change or a snapshot copy, the pte is being zapped. Releasing
+    // takes the page lock after the page has left the index, so the check holds while we keep it.
+    if (ring && vmf->pgoff == 0)
+    {
+        if (READ_ONCE(d_struct_ptr->ring_page) != page)
+        {
+            unlock_page(page);
+            return VM_FAULT_NOPAGE;
+        }
+        return VM_FAULT_LOCKED;
+    }
+    if (xa_load(&d_struct_ptr->pages, index) != page)
+    {
+        unlock_page(page);
+        return VM_FAULT_NOPAGE;
+    }
+    // still shared with a snapshot: swap in a private copy, the retried fault maps it
+    if (xa_get_mark(&d_struct_ptr->pages, index, MYCDRV_SHARED))
+    {
+        unlock_page(page);
+        return mycdrv_get_page_write(d_struct_ptr, index) ? VM_FAULT_NOPAGE : VM_FAULT_OOM;
+    }
+    // a ring has no end of data, its indices live in the control page
+    if (!ring)
+        mycdrv_extend_buf_size(d_struct_ptr, end);
+    // the page changes without us seeing it from now on
+    if (d_struct_ptr->integrity)
+        xa_erase(&d_struct_ptr->crcs, index);
+    return VM_FAULT_LOCKED;
+}
+
+// write to the zero page mapped over a hole: allocate the page and zap the zero page, the retried
+// write fault maps the new page and goes through page_mkwrite.
+static vm_fault_t mycdrv_vm_pfn_mkwrite(struct vm_fault *vmf)
+{
+    asp_mycdev *d_struct_ptr = vmf->vma->vm_private_data;
+    bool ring = READ_ONCE(d_struct_ptr->mode) == MYCDRV_MODE_RING;
+    pgoff_t index = ring ? vmf->pgoff - 1 : vmf->pgoff;
+
+    // switched to ring mode under us, the zap of the mode change refaults the control page
+    if (ring && vmf->pgoff == 0)
+        return VM_FAULT_NOPAGE;
+    if (((loff_t)index << PAGE_SHIFT) >= READ_ONCE(d_struct_ptr->ram_size))
+        return VM_FAULT_SIGBUS;
+    if (!mycdrv_get_page(d_struct_ptr, index))
+        return VM_FAULT_OOM;
+    // make sure the zero page is gone, whoever filled the hole
+    unmap_mapping_range(vmf->vma->vm_file->f_mapping, (loff_t)vmf->pgoff << PAGE_SHIFT, PAGE_SIZE, 0);
+    return VM_FAULT_NOPAGE;
+}
+
+static const struct vm_operations_struct mycdrv_vm_ops =
+    {
+        .fault = mycdrv_vm_fault,
+        .page_mkwrite = mycdrv_vm_page_mkwrite,
+        .pfn_mkwrite = mycdrv_vm_pfn_mkwrite,
+};
+
+static int mycdrv_mmap(struct file *file, struct vm_area_struct *vma)
+{
+    asp_mycdev *d_struct_ptr = (asp_mycdev *)file->private_data;
+    loff_t start = (loff_t)vma->vm_pgoff << PAGE_SHIFT;
+    loff_t limit = READ_ONCE(d_struct_ptr->ram_size);
+
+    if (READ_ONCE(d_struct_ptr->mode) == MYCDRV_MODE_RING)
+        limit += PAGE_SIZE;
+    if (start + (vma->vm_end - vma->vm_start) > limit)
+        return -EINVAL;
+    // records are only added through write, a shared writable mapping would bypass the commit order
+    if (READ_ONCE(d_struct_ptr->mode) == MYCDRV_MODE_LOG && (vma->vm_flags & VM_SHARED))
+    {
+        if (vma->vm_flags & VM_WRITE)
+            return -EACCES;
+        vma->vm_flags &= ~VM_MAYWRITE;
+    }
+
+    // the inode's mapping is only used to zap user mappings, its address_space_operations aren't
+    // touched, so nothing in the inode points into the module once it is unloaded
+    d_struct_ptr->mapping = file->f_mapping;
+    vma->vm_ops = &mycdrv_vm_ops;
+    vma->vm_private_data = d_struct_ptr;
+    // mixed: the device's pages are mapped as pages, the zero page over holes as a pfn
+    vma->vm_flags |= VM_DONTEXPAND | VM_MIXEDMAP;
+    return 0;
+}
+
+// look up a device by number and take a reference, NULL if there is none.
+static asp_mycdev *mycdrv_get_dev(unsigned int minor)
+{
+    asp_mycdev *dev;
+
+    xa_lock(&mycdrv_devices);
+    dev = xa_load(&mycdrv_devices, minor);
+    if (dev)
+        kref_get(&dev->ref);
+    xa_unlock(&mycdrv_devices);
+    return dev;
+}
+
+// the device is gone and its last file closed, free the ramdisk.
+static void mycdrv_free_dev(struct kref *ref)
+{
+    asp_mycdev *devv = container_of(ref, asp_mycdev, ref);
+
+    // no file means no mapping either, and the inode behind the mapping may already be gone
+    devv->mapping = NULL;
+    mycdrv_ring_set(devv, NULL);
+    mycdrv_free_pages(devv);
+    xa_destroy(&devv->pages);
+    xa_destroy(&devv->crcs);
+    if (devv->tfm)
+        crypto_free_comp(devv->tfm);
+    kfree(devv->zbuf);
+    free_percpu(devv->stats);
+    pr_info("EXIT: Free ramdisk for device %d\n", devv->dev_num);
+    kfree(devv);
+}
+
+static void mycdrv_put_dev(asp_mycdev *dev)
+{
+    kref_put(&dev->ref, mycdrv_free_dev);
+}
+
+static const struct block_device_operations mycdrv_blk_fops =
+    {
+        .owner = THIS_MODULE,
+};
+
+// read or write a request against the ramdisk, these are the same pages the char device uses.
+static blk_status_t mycdrv_blk_rw(asp_mycdev *dev, struct request *rq, bool write)
+{
+    struct mycdrv_range range;
+    struct req_iterator iter;
+    struct bio_vec bvec;
+    struct iov_iter it;
+    loff_t pos = (loff_t)blk_rq_pos(rq) << SECTOR_SHIFT;
+    size_t len = blk_rq_bytes(rq), done = 0;
+    blk_status_t status = BLK_STS_OK;
+    struct mycdrv_clock clk;
+    ssize_t ret;
+
+    mycdrv_clock_start(&clk, false);
+    down_read(&dev->sem);
+    // FIFO and ring devices have no block view of their data
+    if (dev->mode != MYCDRV_MODE_RANDOM || pos + len > dev->ram_size)
+    {
+        up_read(&dev->sem);
+        return BLK_STS_IOERR;
+    }
+    mycdrv_range_lock_uninterruptible(dev, &range, pos, pos + len, write);
+    mycdrv_clock_locked(&clk);
+
+    rq_for_each_segment(bvec, rq, iter)
+    {
+        iov_iter_bvec(&it, write ? WRITE : READ, &bvec, 1, bvec.bv_len);
+        if (write)
+            ret = mycdrv_copy_from_iter(dev, pos + done, bvec.bv_len, &it);
+        else
+            ret = mycdrv_copy_to_iter(dev, pos + done, bvec.bv_len, &it);
+        if (ret != bvec.bv_len)
+        {
+            status = BLK_STS_IOERR;
+            break;
+        }
+        done += ret;
+    }
+    if (write && done)
+        mycdrv_extend_buf_size(dev, pos + done);
+    mycdrv_range_unlock(dev, &range);
+    up_read(&dev->sem);
+
+    mycdrv_account_io(dev, write, done, &clk);
+    return status;
+}
+
+static blk_status_t mycdrv_queue_rq(struct blk_mq_hw_ctx *hctx, const struct blk_mq_queue_data *bd)
+{
+    struct request *rq = bd->rq;
+    asp_mycdev *dev = hctx->queue->queuedata;
+    blk_status_t status;
+
+    blk_mq_start_request(rq);
+    switch (req_op(rq))
+    {
+    case REQ_OP_READ:
+        status = mycdrv_blk_rw(dev, rq, false);
+        break;
+    case REQ_OP_WRITE:
+        status = mycdrv_blk_rw(dev, rq, true);
+        break;
+    case REQ_OP_FLUSH:
+        // there is no cache between the queue and the ramdisk
+        status = BLK_STS_OK;
+        break;
+    case REQ_OP_DISCARD:
+        status = errno_to_blk_status(mycdrv_do_zero_range(dev, blk_rq_pos(rq) << SECTOR_SHIFT, blk_rq_bytes(rq), true, false));
+        break;
+    case REQ_OP_WRITE_ZEROES:
+        status = errno_to_blk_status(mycdrv_do_zero_range(dev, blk_rq_pos(rq) << SECTOR_SHIFT, blk_rq_bytes(rq), false, false));
+        break;
+    default:
+        status = BLK_STS_NOTSUPP;
+        break;
+    }
+    blk_mq_end_request(rq, status);
+    return BLK_STS_OK;
+}
+
+static const struct blk_mq_ops mycdrv_mq_ops =
+    {
+        .queue_rq = mycdrv_queue_rq,
+};
+
+// add /dev/mycdrvb<n> over the device's ramdisk, with one hardware queue per cpu.
+static int mycdrv_blk_add(asp_mycdev *dev)
+{
+    struct request_queue *q;
+    struct gendisk *disk;
+    int err;
+
+    dev->tag_set.ops = &mycdrv_mq_ops;
+    dev->tag_set.nr_hw_queues = nr_cpu_ids;
+    dev->tag_set.queue_depth = 128;
+    dev->tag_set.numa_node = NUMA_NO_NODE;
+    // the data path sleeps on range locks and page allocation
+    dev->tag_set.flags = BLK_MQ_F_SHOULD_MERGE | BLK_MQ_F_BLOCKING;
+    err = blk_mq_alloc_tag_set(&dev->tag_set);
+    if (err)
+        return err;
+
+    q = blk_mq_init_queue(&dev->tag_set);
+    if (IS_ERR(q))
+    {
+        err = PTR_ERR(q);
+        goto fail_tags;
+    }
+    q->queuedata = dev;
+    blk_queue_physical_block_size(q, PAGE_SIZE);
+    blk_queue_flag_set(QUEUE_FLAG_NONROT, q);
+    // discard punches holes, write zeroes clears in place
+    blk_queue_flag_set(QUEUE_FLAG_DISCARD, q);
+    blk_queue_max_discard_sectors(q, UINT_MAX >> SECTOR_SHIFT);
+    blk_queue_max_write_zeroes_sectors(q, UINT_MAX >> SECTOR_SHIFT);
+
+    disk = alloc_disk(1);
+    if (!disk)
+    {
+        err = -ENOMEM;
+        goto fail_queue;
+    }
+    disk->major = mycdrv_blk_major;
+    disk->first_minor = dev->dev_num;
+    disk->fops = &mycdrv_blk_fops;
+    disk->private_data = dev;
+    disk->queue = q;
+    disk->flags |= GENHD_FL_NO_PART_SCAN;
+    snprintf(disk->disk_name, DISK_NAME_LEN, DEVICE_NAME "b%d", dev->dev_num);
+    set_capacity(disk, dev->ram_size >> SECTOR_SHIFT);
+    add_disk(disk);
+    dev->disk = disk;
+    return 0;
+
+fail_queue:
+    blk_cleanup_queue(q);
+fail_tags:
+    blk_mq_free_tag_set(&dev->tag_set);
+    return err;
+}
+
+// remove the block device, in-flight requests are drained before the queue goes away.
+static void mycdrv_blk_remove(asp_mycdev *dev)
+{
+    struct gendisk *disk = dev->disk;
+    struct request_queue *q;
+
+    if (!disk)
+        return;
+    // llseek resizes the disk under the exclusive lock
+    down_write(&dev->sem);
+    dev->disk = NULL;
+    up_write(&dev->sem);
+
+    q = disk->queue;
+    del_gendisk(disk);
+    blk_cleanup_queue(q);
+    put_disk(disk);
+    blk_mq_free_tag_set(&dev->tag_set);
+}
+
+// take a device off the system, called under mycdrv_devices_lock. Open files keep it alive.
+static void mycdrv_remove_dev(asp_mycdev *devv)
+{
+    int i = devv->dev_num;
+
+    xa_erase(&mycdrv_devices, i);
+    mycdrv_blk_remove(devv);
+    debugfs_remove_recursive(devv->debugfs);
+
+    device_destroy(mycdrv_class, MKDEV(major_num, i));
+    pr_info("EXIT:  Destroyed device node %d\n", i);
+
+    cdev_del(devv->cdev);
+    pr_info("EXIT:  Deleted cdev for device %d\n", i);
+
+    // nothing re-arms the scan once the sysfs attribute is gone
+    WRITE_ONCE(devv->compress_interval, 0);
+    cancel_delayed_work_sync(&devv->compress_work);
+    mycdrv_put_dev(devv);
+}
+
+// fill the new read-only device dev with the current contents of origin. Populated pages are shared and
+// marked in the origin's index, the origin copies a marked page before it writes it. Compressed pages are
+// small and duplicated. Writers of the origin wait for the walk, which is linear in its populated pages.
+static int mycdrv_snapshot_pages(asp_mycdev *dev, asp_mycdev *origin)
+{
+    struct mycdrv_zpage *zpage;
+    unsigned long index;
+    void *entry, *copy;
+    int err = 0;
+
+    if (down_write_killable(&origin->sem))
+        return -ERESTARTSYS;
+    // a stream or ring has no point in time view
+    if (origin->mode != MYCDRV_MODE_RANDOM)
+    {
+        err = -EINVAL;
+        goto out;
+    }
+    dev->ram_size = origin->ram_size;
+    spin_lock(&origin->size_lock);
+    dev->buf_size = origin->buf_size;
+    spin_unlock(&origin->size_lock);
+    // the compression scan is held off by the exclusive lock, no new compressed pages turn up
+    if (atomic_long_read(&origin->zpages))
+    {
+        err = mycdrv_alloc_compressor(dev);
+        if (err)
+            goto out;
+    }
+
+    mutex_lock(&origin->zlock);
+    xa_for_each(&origin->pages, index, entry)
+    {
+        if (mycdrv_is_zpage(entry))
+        {
+            zpage = xa_untag_pointer(entry);
+            copy = kmemdup(zpage, struct_size(zpage, data, zpage->len), GFP_KERNEL);
+            if (!copy)
+            {
+                err = -ENOMEM;
+                break;
+            }
+            atomic_long_inc(&dev->zpages);
+            atomic_long_add(zpage->len, &dev->zbytes);
+            entry = xa_tag_pointer(copy, MYCDRV_ZPAGE_TAG);
+        }
+        else
+        {
+            // a write fault may have copied the page since the walk found it, share what is there now
+            xa_lock(&origin->pages);
+            entry = xa_load(&origin->pages, index);
+            get_page(entry);
+            xa_unlock(&origin->pages);
+            // a write fault that checked the mark before it was set holds the page lock until its pte
+            // is in, the zap below removes that pte again
+            lock_page(entry);
+            xa_set_mark(&origin->pages, index, MYCDRV_SHARED);
+            unlock_page(entry);
+        }
+        err = xa_err(xa_store(&dev->pages, index, entry, GFP_KERNEL));
+        if (err)
+        {
+            if (mycdrv_is_zpage(entry))
+                mycdrv_free_zpage(dev, entry);
+            else
+                put_page(entry);
+            break;
+        }
+        cond_resched();
+    }
+    mutex_unlock(&origin->zlock);
+
+    // write protect the origin's mappings, their next write faults and copies the page
+    if (!err && origin->mapping)
+        unmap_mapping_range(origin->mapping, 0, 0, 0);
+out:
+    up_write(&origin->sem);
+    return err;
+}
+
+// create /dev/mycdrv<spec->dev>, called under mycdrv_devices_lock. spec->dev is set to the number used.
+// With an origin the device is a read-only snapshot of it.
+static asp_mycdev *mycdrv_create_dev(struct mycdrv_dev_spec *spec, asp_mycdev *origin)
+{
+    asp_mycdev *dev;
+    struct page *ring_page;
+    struct device *device;
+    u64 size = spec->size ? spec->size : ramdisk_size;
+    char name[16];
+    u32 minor;
+    int err;
+
+    if (spec->mode != MYCDRV_MODE_RANDOM && spec->mode != MYCDRV_MODE_FIFO && spec->mode != MYCDRV_MODE_RING &&
+        spec->mode != MYCDRV_MODE_LOG)
+        return ERR_PTR(-EINVAL);
+    if ((spec->flags & ~(MYCDRV_DEV_BLKDEV | MYCDRV_DEV_HUGE | MYCDRV_DEV_CRC)) || spec->pad)
+        return ERR_PTR(-EINVAL);
+    // a huge page backed device holds whole runs
+    if (size <= MAX_LFS_FILESIZE)
+        size = round_up(size, (spec->flags & MYCDRV_DEV_HUGE) ? MYCDRV_HUGE_SIZE : PAGE_SIZE);
+    if (!size || size > MAX_LFS_FILESIZE || !mycdrv_node_valid(spec->numa_node))
+        return ERR_PTR(-EINVAL);
+    if (spec->mode == MYCDRV_MODE_RING && !is_power_of_2(size))
+        return ERR_PTR(-EINVAL);
+
+    dev = kzalloc(sizeof(*dev), GFP_KERNEL);
+    if (!dev)
+        return ERR_PTR(-ENOMEM);
+    kref_init(&dev->ref);
+    dev->ram_size = size;
+    atomic_set(&dev->counter, 0);
+    dev->buf_size = 0;
+    spin_lock_init(&dev->size_lock);
+    xa_init(&dev->pages);
+    init_rwsem(&dev->sem);
+    spin_lock_init(&dev->range_lock);
+    INIT_LIST_HEAD(&dev->ranges);
+    init_waitqueue_head(&dev->rangeq);
+    dev->mode = spec->mode;
+    init_waitqueue_head(&dev->readq);
+    init_waitqueue_head(&dev->writeq);
+    atomic64_set(&dev->log_tail, 0);
+    atomic64_set(&dev->log_committed, 0);
+    spin_lock_init(&dev->log_lock);
+    INIT_LIST_HEAD(&dev->log_recs);
+    init_waitqueue_head(&dev->commitq);
+    dev->node = spec->numa_node;
+    dev->huge = spec->flags & MYCDRV_DEV_HUGE;
+    // a snapshot never changes, and shares its pages with a device that keeps the checksums
+    dev->integrity = (spec->flags & MYCDRV_DEV_CRC) && !origin;
+    xa_init(&dev->crcs);
+    mutex_init(&dev->zlock);
+    INIT_DELAYED_WORK(&dev->compress_work, mycdrv_compress_work);
+    dev->stats = alloc_percpu(struct mycdrv_stats);
+    if (!dev->stats)
+    {
+        err = -ENOMEM;
+        goto fail;
+    }
+    if (spec->mode == MYCDRV_MODE_RING)
+    {
+        ring_page = alloc_page(GFP_KERNEL | __GFP_ZERO);
+        if (!ring_page)
+        {
+            err = -ENOMEM;
+            goto fail;
+        }
+        ((struct mycdrv_ring_ctrl *)page_address(ring_page))->ring_size = size;
+        mycdrv_ring_set(dev, ring_page);
+    }
+    if (origin)
+    {
+        dev->readonly = true;
+        err = mycdrv_snapshot_pages(dev, origin);
+        if (err)
+            goto fail;
+    }
+
+    // reserve the number, opening the node finds no device until it is complete
+    if (spec->dev == MYCDRV_DEV_ANY)
+        err = xa_alloc(&mycdrv_devices, &minor, NULL, XA_LIMIT(0, MYCDRV_MAX_DEVICES - 1), GFP_KERNEL);
+    else if (spec->dev >= MYCDRV_MAX_DEVICES)
+        err = -EINVAL;
+    else
+    {
+        minor = spec->dev;
+        err = xa_insert(&mycdrv_devices, minor, NULL, GFP_KERNEL);
+    }
+    if (err)
+        goto fail;
+    dev->dev_num = minor;
+
+    // the cdev has a lifetime of its own, an open file may outlive the device
+    dev->cdev = cdev_alloc();
+    if (!dev->cdev)
+    {
+        err = -ENOMEM;
+        goto fail_minor;
+    }
+    dev->cdev->ops = &mycdrv_fops;
+    dev->cdev->owner = THIS_MODULE;
+    // add character device to the system VFS
+    err = cdev_add(dev->cdev, MKDEV(major_num, minor), 1);
+    if (err)
+    {
+        kobject_put(&dev->cdev->kobj);
+        goto fail_minor;
+    }
+    // the sysfs attributes find the device through its drvdata
+    device = device_create_with_groups(mycdrv_class, NULL, MKDEV(major_num, minor), dev, mycdrv_groups, DEVICE_NAME "%u", minor);
+    if (IS_ERR(device))
+    {
+        err = PTR_ERR(device);
+        cdev_del(dev->cdev);
+        goto fail_minor;
+    }
+
+    snprintf(name, sizeof(name), DEVICE_NAME "%u", minor);
+    dev->debugfs = debugfs_create_dir(name, mycdrv_debugfs_root);
+    debugfs_create_file("stats", 0444, dev->debugfs, dev, &mycdrv_stats_fops);
+    debugfs_create_file("reset", 0200, dev->debugfs, dev, &mycdrv_reset_fops);
+
+    // replacing the reserved entry doesn't allocate
+    xa_store(&mycdrv_devices, minor, dev, GFP_KERNEL);
+    err = 0;
+    if (spec->compress_interval)
+        err = mycdrv_set_compress_interval(dev, spec->compress_interval);
+    if (!err && (spec->flags & MYCDRV_DEV_BLKDEV))
+        err = mycdrv_blk_add(dev);
+    if (err)
+    {
+        mycdrv_remove_dev(dev);
+        return ERR_PTR(err);
+    }
+    spec->dev = minor;
+    return dev;
+
+fail_minor:
+    xa_erase(&mycdrv_devices, minor);
+fail:
+    mycdrv_put_dev(dev);
+    return ERR_PTR(err);
+}
+
+static void mycdrv_remove_all(void)
+{
+    asp_mycdev *dev;
+    unsigned long index;
+
+    mutex_lock(&mycdrv_devices_lock);
+    xa_for_each(&mycdrv_devices, index, dev)
+        mycdrv_remove_dev(dev);
+    mutex_unlock(&mycdrv_devices_lock);
+}
+
+// /dev/mycdrv-control: add and remove devices while the module is loaded.
+static long mycdrv_ctl_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+    struct mycdrv_dev_spec spec;
+    struct mycdrv_snapshot_spec snap;
+    asp_mycdev *dev, *origin;
+
+    if (!capable(CAP_SYS_ADMIN))
+        return -EPERM;
+
+    switch (cmd)
+    {
+    case ASP_DEV_ADD:
+        if (copy_from_user(&spec, (void __user *)arg, sizeof(spec)))
+            return -EFAULT;
+        mutex_lock(&mycdrv_devices_lock);
+        dev = mycdrv_create_dev(&spec, NULL);
+        mutex_unlock(&mycdrv_devices_lock);
+        if (IS_ERR(dev))
+            return PTR_ERR(dev);
+        pr_info("INIT: Succesfully registered character device %s%u\n", DEVICE_NAME, spec.dev);
+        // the device exists either way, a bad buffer only loses the number
+        if (copy_to_user((void __user *)arg, &spec, sizeof(spec)))
+            return -EFAULT;
+        return 0;
+
+    case ASP_DEV_REMOVE:
+        mutex_lock(&mycdrv_devices_lock);
+        dev = arg < MYCDRV_MAX_DEVICES ? xa_load(&mycdrv_devices, arg) : NULL;
+        if (dev)
+            mycdrv_remove_dev(dev);
+        mutex_unlock(&mycdrv_devices_lock);
+        return dev ? 0 : -ENODEV;
+
+    case ASP_DEV_SNAPSHOT:
+        if (copy_from_user(&snap, (void __user *)arg, sizeof(snap)))
+            return -EFAULT;
+        if (snap.flags || snap.pad)
+            return -EINVAL;
+        mutex_lock(&mycdrv_devices_lock);
+        // the device table's reference keeps the origin while we hold the lock
+        origin = snap.src_dev < MYCDRV_MAX_DEVICES ? xa_load(&mycdrv_devices, snap.src_dev) : NULL;
+        if (origin)
+        {
+            memset(&spec, 0, sizeof(spec));
+            spec.dev = snap.dev;
+            spec.mode = MYCDRV_MODE_RANDOM;
+            spec.size = origin->ram_size;
+            spec.numa_node = READ_ONCE(origin->node);
+            dev = mycdrv_create_dev(&spec, origin);
+        }
+        else
+            dev = ERR_PTR(-ENODEV);
+        mutex_unlock(&mycdrv_devices_lock);
+        if (IS_ERR(dev))
+            return PTR_ERR(dev);
+        pr_info("INIT: Snapshot of device %u is %s%u\n", snap.src_dev, DEVICE_NAME, spec.dev);
+        snap.dev = spec.dev;
+        if (copy_to_user((void __user *)arg, &snap, sizeof(snap)))
+            return -EFAULT;
+        return 0;
+
+    default:
+        return -ENOTTY;
+    }
+}
+
+static const struct file_operations mycdrv_ctl_fops =
+    {
+        .owner = THIS_MODULE,
+        .open = nonseekable_open,
+        .unlocked_ioctl = mycdrv_ctl_ioctl,
+        .llseek = noop_llseek,
+};
+
+// module parameters -
+module_param(NUM_DEVICES, int, S_IRUGO);
+module_param(stream_mode, bool, S_IRUGO);
+MODULE_PARM_DESC(stream_mode, "Create the devices in FIFO stream mode (default: random access)");
+module_param(numa_node, int, S_IRUGO);
+MODULE_PARM_DESC(numa_node, "NUMA node of the ramdisk pages (default: node of the writing cpu)");
+module_param(numa_interleave, bool, S_IRUGO);
+MODULE_PARM_DESC(numa_interleave, "Interleave the ramdisk pages over the online nodes");
+module_param(compress_interval, uint, S_IRUGO);
+MODULE_PARM_DESC(compress_interval, "Compress pages untouched for this many seconds (default: 0, off)");
+module_param(blkdev, bool, S_IRUGO);
+MODULE_PARM_DESC(blkdev, "Also create a blk-mq block device /dev/mycdrvb<n> for each device");
+module_param(huge_pages, bool, S_IRUGO);
+MODULE_PARM_DESC(huge_pages, "Allocate the ramdisk pages in 2 MiB runs, falling back to single pages");
+module_param(integrity, bool, S_IRUGO);
+MODULE_PARM_DESC(integrity, "Keep a crc32c of every page and verify it on read (default: off)");
+module_param(latency_stats, bool, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(latency_stats, "Time reads and writes for the lock wait and latency stats (default: off)");
+static int __init my_init(void)
+{
+    struct mycdrv_dev_spec spec;
+    asp_mycdev *dev;
+    int err, i;
+
+    if (numa_node != NUMA_NO_NODE && (numa_node < 0 || !mycdrv_node_valid(numa_node)))
+    {
+        pr_err("INIT Error numa_node %d is not an online node\n", numa_node);
+        return -EINVAL;
+    }
+    if (NUM_DEVICES > MYCDRV_MAX_DEVICES)
+    {
+        pr_err("INIT Error NUM_DEVICES is limited to %d\n", MYCDRV_MAX_DEVICES);
+        return -EINVAL;
+    }
+
+    // get range of minor numbers for every possible device and the control node, and dynamic major number.
+    if (alloc_chrdev_region(&maj_min, 0, MYCDRV_MINORS, DEVICE_NAME) != 0)
+    {
+        pr_info("INIT ERROR (mycdrv): Could not create major number dynamically.\n");
+        return -1;
+    }
+    major_num = MAJOR(maj_min);
+    // create class device nodes
+    mycdrv_class = class_create(THIS_MODULE, DEVICE_NAME);
+    if (IS_ERR(mycdrv_class))
+    {
+        pr_info("INIT ERROR (mycdrv): Class creation failed.\n");
+        unregister_chrdev_region(maj_min, MYCDRV_MINORS);
+        return -1;
+    }
+    mycdrv_debugfs_root = debugfs_create_dir(DEVICE_NAME, NULL);
+
+    mycdrv_blk_major = register_blkdev(0, DEVICE_NAME);
+    if (mycdrv_blk_major < 0)
+    {
+        err = mycdrv_blk_major;
+        pr_err("INIT Error %d registering the block major\n", err);
+        goto fail_blk;
+    }
+
+    cdev_init(&mycdrv_ctl_cdev, &mycdrv_ctl_fops);
+    mycdrv_ctl_cdev.owner = THIS_MODULE;
+    err = cdev_add(&mycdrv_ctl_cdev, MKDEV(major_num, MYCDRV_CTL_MINOR), 1);
+    if (err)
+    {
+        pr_err("INIT Error %d adding the control node\n", err);
+        goto fail_ctl;
+    }
+    device_create(mycdrv_class, NULL, MKDEV(major_num, MYCDRV_CTL_MINOR), NULL, DEVICE_NAME "-control");
+
+    // create the initial devices, their ramdisks fill in on first write
+    mutex_lock(&mycdrv_devices_lock);
+    for (i = 0; i < NUM_DEVICES; i++)
+    {
+        spec = (struct mycdrv_dev_spec){
+            .dev = i,
+            .mode = stream_mode ? MYCDRV_MODE_FIFO : MYCDRV_MODE_RANDOM,
+            .size = ramdisk_size,
+            .numa_node = numa_interleave ? MYCDRV_NODE_INTERLEAVE : numa_node,
+            .compress_interval = compress_interval,
+            .flags = (blkdev ? MYCDRV_DEV_BLKDEV : 0) | (huge_pages ? MYCDRV_DEV_HUGE : 0) |
+                     (integrity ? MYCDRV_DEV_CRC : 0),
+        };
+        dev = mycdrv_create_dev(&spec, NULL);
+        if (IS_ERR(dev))
+        {
+            err = PTR_ERR(dev);
+            pr_err("INIT Error %d adding device node %d\n", err, i);
+            break;
+        }
+        pr_info("INIT: Succesfully registered character device %s%d\n", DEVICE_NAME, i);
+    }
+    mutex_unlock(&mycdrv_devices_lock);
+    if (i < NUM_DEVICES)
+        goto fail_devices;
+    mycdrv_kunit_init();
+    return 0;
+
+fail_devices:
+    mycdrv_remove_all();
+    device_destroy(mycdrv_class, MKDEV(major_num, MYCDRV_CTL_MINOR));
+    cdev_del(&mycdrv_ctl_cdev);
+fail_ctl:
+    unregister_blkdev(mycdrv_blk_major, DEVICE_NAME);
+fail_blk:
+    debugfs_remove_recursive(mycdrv_debugfs_root);
+    class_destroy(mycdrv_class);
+    unregister_chrdev_region(maj_min, MYCDRV_MINORS);
+    return err;
+}
+
+static int mycdrv_open(struct inode *inode, struct file *file)
+{
+    // static int counter = 0;
+    asp_mycdev *d_struct_ptr;
+    int count;
+
+    // the device may be removed while the file is open, the reference keeps it until release
+    d_struct_ptr = mycdrv_get_dev(iminor(inode));
+    if (!d_struct_ptr)
+        return -ENODEV;
+    if (d_struct_ptr->readonly && (file->f_mode & FMODE_WRITE))
+    {
+        mycdrv_put_dev(d_struct_ptr);
+        return -EROFS;
+    }
+    // store the pointer in files private data.
+    file->private_data = d_struct_ptr;
+    // reads and writes honor IOCB_NOWAIT, so io_uring can complete them inline
+    file->f_mode |= FMODE_NOWAIT;
+
+    // keeping track of the count, no need to sleep on the data lock for it
+    count = atomic_inc_return(&d_struct_ptr->counter);
+
+    trace_mycdrv_open(d_struct_ptr->dev_num, count);
+    return 0;
+}
+
+static int mycdrv_release(struct inode *inode, struct file *file)
+{
+    asp_mycdev *d_struct_ptr;
+
+    d_struct_ptr = (asp_mycdev *)file->private_data;
+    // decrement count when device closes
+    trace_mycdrv_release(d_struct_ptr->dev_num, atomic_dec_return(&d_struct_ptr->counter));
+    mycdrv_put_dev(d_struct_ptr);
+    return 0;
+}
+// module init
+module_init(my_init);
+
+// read the whole iterator at *ppos under one lock acquisition, shared by read_iter and ASP_IO_BATCH.
+// With nowait (IOCB_NOWAIT) it returns -EAGAIN instead of sleeping, io_uring then retries from a worker.
+static ssize_t mycdrv_do_read(asp_mycdev *d_struct_ptr, loff_t *ppos, struct iov_iter *to, bool nowait)
+{
+    ssize_t nbytes = 0;
+    size_t lbuf = iov_iter_count(to);
+    loff_t pos = *ppos;
+    struct mycdrv_range range;
+    struct mycdrv_clock clk;
+    u64 latency;
+    int err;
+
+    mycdrv_clock_start(&clk, trace_mycdrv_read_enabled());
+    // concurrent readers share the device
+    if (nowait)
+    {
+        if (!down_read_trylock(&d_struct_ptr->sem))
+            return -EAGAIN;
+    }
+    else if (down_read_interruptible(&d_struct_ptr->sem))
+        return -ERESTARTSYS;
+    // reading past the end of the device returns 0
+    if (mycdrv_core_rw_fits(pos, lbuf, d_struct_ptr->ram_size))
+    {
+        // only waits for a writer of an overlapping range
+        err = nowait ? mycdrv_range_lock_nowait(d_struct_ptr, &range, pos, pos + lbuf, false)
+                     : mycdrv_range_lock(d_struct_ptr, &range, pos, pos + lbuf, false);
+        if (err)
+        {
+            up_read(&d_struct_ptr->sem);
+            return err;
+        }
+        // decompressing a cold page sleeps
+        if (nowait && !mycdrv_range_resident(d_struct_ptr, pos, lbuf, false))
+        {
+            mycdrv_range_unlock(d_struct_ptr, &range);
+            up_read(&d_struct_ptr->sem);
+            return -EAGAIN;
+        }
+        mycdrv_clock_locked(&clk);
+        nbytes = mycdrv_copy_to_iter(d_struct_ptr, pos, lbuf, to);
+        if (nbytes > 0)
+            *ppos += nbytes;
+        mycdrv_range_unlock(d_struct_ptr, &range);
+    }
+    else
+        mycdrv_clock_locked(&clk);
+    up_read(&d_struct_ptr->sem);
+
+    latency = mycdrv_account_io(d_struct_ptr, false, nbytes, &clk);
+    trace_mycdrv_read(d_struct_ptr->dev_num, pos, lbuf, nbytes, latency);
+    return nbytes;
+}
+
+// write the whole iterator at *ppos under one lock acquisition, shared by write_iter and ASP_IO_BATCH.
+// nowait behaves as for mycdrv_do_read.
+static ssize_t mycdrv_do_write(asp_mycdev *d_struct_ptr, loff_t *ppos, struct iov_iter *from, bool nowait)
+{
+    ssize_t nbytes = 0;
+    size_t lbuf = iov_iter_count(from);
+    loff_t pos = *ppos;
+    struct mycdrv_range range;
+    struct mycdrv_clock clk;
+    u64 latency;
+    int err;
+
+    mycdrv_clock_start(&clk, trace_mycdrv_write_enabled());
+    // writers share the device too, the range lock keeps overlapping writes and reads apart
+    if (nowait)
+    {
+        if (!down_read_trylock(&d_struct_ptr->sem))
+            return -EAGAIN;
+    }
+    else if (down_read_killable(&d_struct_ptr->sem))
+        return -ERESTARTSYS;
+    // writing past the end of the device returns 0
+    if (mycdrv_core_rw_fits(pos, lbuf, d_struct_ptr->ram_size))
+    {
+        err = nowait ? mycdrv_range_lock_nowait(d_struct_ptr, &range, pos, pos + lbuf, true)
+                     : mycdrv_range_lock(d_struct_ptr, &range, pos, pos + lbuf, true);
+        if (err)
+        {
+            up_read(&d_struct_ptr->sem);
+            return err;
+        }
+        // a first write allocates its page, leave that to the blocking retry
+        if (nowait && !mycdrv_range_resident(d_struct_ptr, pos, lbuf, true))
+        {
+            mycdrv_range_unlock(d_struct_ptr, &range);
+            up_read(&d_struct_ptr->sem);
+            return -EAGAIN;
+        }
+        mycdrv_clock_locked(&clk);
+        // copy data from the user segments into the ramdisk pages, pages are installed with xa_cmpxchg
+        nbytes = mycdrv_copy_from_iter(d_struct_ptr, pos, lbuf, from);
+        if (nbytes > 0)
+        {
+            // buf_size tracks the end of the written data
+            mycdrv_extend_buf_size(d_struct_ptr, pos + nbytes);
+            *ppos += nbytes;
+        }
+        mycdrv_range_unlock(d_struct_ptr, &range);
+    }
+    else
+        mycdrv_clock_locked(&clk);
+    up_read(&d_struct_ptr->sem);
+
+    latency = mycdrv_account_io(d_struct_ptr, true, nbytes, &clk);
+    trace_mycdrv_write(d_struct_ptr->dev_num, pos, lbuf, nbytes, latency);
+    return nbytes;
+}
+
+// copy len bytes of the FIFO starting at stream offset from, wrapping around the end of the ramdisk.
+static ssize_t mycdrv_fifo_copy_to_iter(asp_mycdev *dev, u64 from, size_t len, struct iov_iter *to)
+{
+    loff_t pos = from % dev->ram_size;
+    size_t first = min_t(size_t, len, dev->ram_size - pos);
+    ssize_t ret, more;
+
+    ret = mycdrv_copy_to_iter(dev, pos, first, to);
+    if (ret == first && len > first)
+    {
+        more = mycdrv_copy_to_iter(dev, 0, len - first, to);
+        if (more > 0)
+            ret += more;
+    }
+    return ret;
+}
+
+static ssize_t mycdrv_fifo_copy_from_iter(asp_mycdev *dev, u64 from, size_t len, struct iov_iter *iter)
+{
+    loff_t pos = from % dev->ram_size;
+    size_t first = min_t(size_t, len, dev->ram_size - pos);
+    ssize_t ret, more;
+
+    ret = mycdrv_copy_from_iter(dev, pos, first, iter);
+    if (ret == first && len > first)
+    {
+        more = mycdrv_copy_from_iter(dev, 0, len - first, iter);
+        if (more > 0)
+            ret += more;
+    }
+    return ret;
+}
+
+// mycdrv_range_resident for the len bytes of the FIFO starting at stream offset from.
+static bool mycdrv_fifo_resident(asp_mycdev *dev, u64 from, size_t len, bool write)
+{
+    loff_t pos = from % dev->ram_size;
+    size_t first = min_t(size_t, len, dev->ram_size - pos);
+
+    return mycdrv_range_resident(dev, pos, first, write) && mycdrv_range_resident(dev, 0, len - first, write);
+}
+
+// take the FIFO lock, without sleeping for IOCB_NOWAIT.
+static int mycdrv_fifo_lock(asp_mycdev *d_struct_ptr, bool nowait)
+{
+    if (nowait)
+        return down_write_trylock(&d_struct_ptr->sem) ? 0 : -EAGAIN;
+    if (down_write_killable(&d_struct_ptr->sem))
+        return -ERESTARTSYS;
+    return 0;
+}
+
+// FIFO mode read: consume up to the requested bytes, blocking until the stream has data.
+// nowait (IOCB_NOWAIT) implies nonblock and also fails with -EAGAIN where the copy would sleep.
+static ssize_t mycdrv_fifo_read(asp_mycdev *d_struct_ptr, struct iov_iter *to, bool nonblock, bool nowait)
+{
+    size_t lbuf = iov_iter_count(to);
+    ssize_t nbytes;
+    size_t len;
+    struct mycdrv_clock clk;
+    u64 latency;
+    int err;
+
+    if (!lbuf)
+        return 0;
+    mycdrv_clock_start(&clk, trace_mycdrv_read_enabled());
+    nonblock |= nowait;
+    // the stream position moves on every read, so readers take the lock exclusively
+    err = mycdrv_fifo_lock(d_struct_ptr, nowait);
+    if (err)
+        return err;
+    while (d_struct_ptr->fifo_tail == d_struct_ptr->fifo_head)
+    {
+        up_write(&d_struct_ptr->sem);
+        if (nonblock)
+            return -EAGAIN;
+        if (wait_event_interruptible(d_struct_ptr->readq,
+                                     READ_ONCE(d_struct_ptr->fifo_tail) != READ_ONCE(d_struct_ptr->fifo_head) ||
+                                         READ_ONCE(d_struct_ptr->mode) != MYCDRV_MODE_FIFO))
+            return -ERESTARTSYS;
+        err = mycdrv_fifo_lock(d_struct_ptr, nowait);
+        if (err)
+            return err;
+        // the device was switched to another mode while we slept
+        if (d_struct_ptr->mode != MYCDRV_MODE_FIFO)
+        {
+            up_write(&d_struct_ptr->sem);
+            return 0;
+        }
+    }
+    len = min_t(u64, lbuf, d_struct_ptr->fifo_tail - d_struct_ptr->fifo_head);
+    if (nowait && !mycdrv_fifo_resident(d_struct_ptr, d_struct_ptr->fifo_head, len, false))
+    {
+        up_write(&d_struct_ptr->sem);
+        return -EAGAIN;
+    }
+    mycdrv_clock_locked(&clk);
+    nbytes = mycdrv_fifo_copy_to_iter(d_struct_ptr, d_struct_ptr->fifo_head, len, to);
+    if (nbytes > 0)
+        d_struct_ptr->fifo_head += nbytes;
+    up_write(&d_struct_ptr->sem);
+    wake_up_interruptible(&d_struct_ptr->writeq);
+
+    latency = mycdrv_account_io(d_struct_ptr, false, nbytes, &clk);
+    trace_mycdrv_read(d_struct_ptr->dev_num, 0, lbuf, nbytes, latency);
+    return nbytes;
+}
+
+// FIFO mode write: append as much as fits, blocking while the stream is full.
+static ssize_t mycdrv_fifo_write(asp_mycdev *d_struct_ptr, struct iov_iter *from, bool nonblock, bool nowait)
+{
+    size_t lbuf = iov_iter_count(from);
+    ssize_t nbytes;
+    size_t len;
+    struct mycdrv_clock clk;
+    u64 latency;
+    int err;
+
+    if (!lbuf)
+        return 0;
+    mycdrv_clock_start(&clk, trace_mycdrv_write_enabled());
+    nonblock |= nowait;
+    err = mycdrv_fifo_lock(d_struct_ptr, nowait);
+    if (err)
+        return err;
+    while (d_struct_ptr->fifo_tail - d_struct_ptr->fifo_head >= d_struct_ptr->ram_size)
+    {
+        up_write(&d_struct_ptr->sem);
+        if (nonblock)
+            return -EAGAIN;
+        if (wait_event_interruptible(d_struct_ptr->writeq,
+                                     READ_ONCE(d_struct_ptr->fifo_tail) - READ_ONCE(d_struct_ptr->fifo_head) < d_struct_ptr->ram_size ||
+                                         READ_ONCE(d_struct_ptr->mode) != MYCDRV_MODE_FIFO))
+            return -ERESTARTSYS;
+        err = mycdrv_fifo_lock(d_struct_ptr, nowait);
+        if (err)
+            return err;
+        if (d_struct_ptr->mode != MYCDRV_MODE_FIFO)
+        {
+            up_write(&d_struct_ptr->sem);
+            return -EINVAL;
+        }
+    }
+    len = min_t(u64, lbuf, d_struct_ptr->ram_size - (d_struct_ptr->fifo_tail - d_struct_ptr->fifo_head));
+    if (nowait && !mycdrv_fifo_resident(d_struct_ptr, d_struct_ptr->fifo_tail, len, true))
+    {
+        up_write(&d_struct_ptr->sem);
+        return -EAGAIN;
+    }
+    mycdrv_clock_locked(&clk);
+    nbytes = mycdrv_fifo_copy_from_iter(d_struct_ptr, d_struct_ptr->fifo_tail, len, from);
+    if (nbytes > 0)
+        d_struct_ptr->fifo_tail += nbytes;
+    up_write(&d_struct_ptr->sem);
+    wake_up_interruptible(&d_struct_ptr->readq);
+
+    latency = mycdrv_account_io(d_struct_ptr, true, nbytes, &clk);
+    trace_mycdrv_write(d_struct_ptr->dev_num, 0, lbuf, nbytes, latency);
+    return nbytes;
+}
+
+// the ring has data for the consumer when the producer index is ahead of the consumer index.
+static bool mycdrv_ring_ready(asp_mycdev *dev, struct page *page)
+{
+    struct mycdrv_ring_ctrl *ctrl = page_address(page);
+
+    return READ_ONCE(ctrl->producer) != READ_ONCE(ctrl->consumer) || READ_ONCE(dev->ring_page) != page;
+}
+
+// ASP_RING_WAIT: the consumer found the ring empty, sleep until the producer kicks us.
+static long mycdrv_ring_wait(asp_mycdev *d_struct_ptr)
+{
+    struct page *page = mycdrv_ring_get(d_struct_ptr);
+    struct mycdrv_ring_ctrl *ctrl;
+    long ret;
+
+    if (!page)
+        return -EINVAL;
+    ctrl = page_address(page);
+    WRITE_ONCE(ctrl->consumer_waiting, 1);
+    // pairs with the producer's barrier between publishing its index and testing consumer_waiting,
+    // either we see the new index or the producer sees the flag and kicks
+    smp_mb();
+    ret = wait_event_interruptible(d_struct_ptr->readq, mycdrv_ring_ready(d_struct_ptr, page));
+    WRITE_ONCE(ctrl->consumer_waiting, 0);
+    put_page(page);
+    return ret;
+}
+
+// ring mode poll only reports the consumer side, the producer owns the free space accounting.
+static __poll_t mycdrv_ring_poll(asp_mycdev *d_struct_ptr, struct file *file, poll_table *wait)
+{
+    struct page *page = mycdrv_ring_get(d_struct_ptr);
+    struct mycdrv_ring_ctrl *ctrl;
+    __poll_t mask = 0;
+
+    if (!page)
+        return EPOLLERR;
+    ctrl = page_address(page);
+    poll_wait(file, &d_struct_ptr->readq, wait);
+    // same handshake as ASP_RING_WAIT, the consumer clears the flag itself once it has data
+    WRITE_ONCE(ctrl->consumer_waiting, 1);
+    smp_mb();
+    if (mycdrv_ring_ready(d_struct_ptr, page))
+        mask |= EPOLLIN | EPOLLRDNORM;
+    put_page(page);
+    return mask;
+}
+
+// random-access devices are always ready, FIFO devices report whether the stream has data or space
+// and log devices whether there are records past the file position.
+static __poll_t mycdrv_poll(struct file *file, poll_table *wait)
+{
+    asp_mycdev *d_struct_ptr = (asp_mycdev *)file->private_data;
+    __poll_t mask = 0;
+    u64 used;
+
+    if (READ_ONCE(d_struct_ptr->mode) == MYCDRV_MODE_RING)
+        return mycdrv_ring_poll(d_struct_ptr, file, wait);
+    // a log reader is woken when records are committed past its position
+    if (READ_ONCE(d_struct_ptr->mode) == MYCDRV_MODE_LOG)
+    {
+        poll_wait(file, &d_struct_ptr->readq, wait);
+        mask = EPOLLOUT | EPOLLWRNORM;
+        if (atomic64_read_acquire(&d_struct_ptr->log_committed) > file->f_pos)
+            mask |= EPOLLIN | EPOLLRDNORM;
+        return mask;
+    }
+    if (READ_ONCE(d_struct_ptr->mode) != MYCDRV_MODE_FIFO)
+        return EPOLLIN | EPOLLRDNORM | EPOLLOUT | EPOLLWRNORM;
+
+    poll_wait(file, &d_struct_ptr->readq, wait);
+    poll_wait(file, &d_struct_ptr->writeq, wait);
+    used = READ_ONCE(d_struct_ptr->fifo_tail) - READ_ONCE(d_struct_ptr->fifo_head);
+    if (used)
+        mask |= EPOLLIN | EPOLLRDNORM;
+    if (used < READ_ONCE(d_struct_ptr->ram_size))
+        mask |= EPOLLOUT | EPOLLWRNORM;
+    return mask;
+}
+
+// switch the device between random-access, FIFO, ring and log mode, the contents are dropped.
+static long mycdrv_set_mode(asp_mycdev *d_struct_ptr, struct file *file, int mode)
+{
+    struct page *ring_page = NULL;
+    struct mycdrv_ring_ctrl *ctrl;
+
+    if (mode != MYCDRV_MODE_RANDOM && mode != MYCDRV_MODE_FIFO && mode != MYCDRV_MODE_RING && mode != MYCDRV_MODE_LOG)
+        return -EINVAL;
+    if (mode == MYCDRV_MODE_RING)
+    {
+        ring_page = alloc_page(GFP_KERNEL | __GFP_ZERO);
+        if (!ring_page)
+            return -ENOMEM;
+    }
+    if (down_write_killable(&d_struct_ptr->sem))
+    {
+        if (ring_page)
+            __free_page(ring_page);
+        return -ERESTARTSYS;
+    }
+    // the ring indices are masked, so the size can't be an arbitrary number of pages
+    if (ring_page && !is_power_of_2(d_struct_ptr->ram_size))
+    {
+        up_write(&d_struct_ptr->sem);
+        __free_page(ring_page);
+        return -EINVAL;
+    }
+    if (ring_page)
+    {
+        ctrl = page_address(ring_page);
+        ctrl->ring_size = d_struct_ptr->ram_size;
+    }
+    mycdrv_ring_set(d_struct_ptr, ring_page);
+    mycdrv_free_pages(d_struct_ptr);
+    file->f_pos = 0;
+    spin_lock(&d_struct_ptr->size_lock);
+    d_struct_ptr->buf_size = 0;
+    spin_unlock(&d_struct_ptr->size_lock);
+    d_struct_ptr->fifo_head = 0;
+    d_struct_ptr->fifo_tail = 0;
+    atomic64_set(&d_struct_ptr->log_tail, 0);
+    atomic64_set(&d_struct_ptr->log_committed, 0);
+    WRITE_ONCE(d_struct_ptr->mode, mode);
+    up_write(&d_struct_ptr->sem);
+
+    // blocked readers and writers recheck the mode
+    wake_up_interruptible_all(&d_struct_ptr->readq);
+    wake_up_interruptible_all(&d_struct_ptr->writeq);
+    return 0;
+}
+
+// splice asks for as much as the pipe holds, clamp it so a read crossing the end of the device isn't turned into EOF.
+static ssize_t mycdrv_splice_read(struct file *in, loff_t *ppos, struct pipe_inode_info *pipe, size_t len, unsigned int flags)
+{
+    asp_mycdev *d_struct_ptr = (asp_mycdev *)in->private_data;
+    loff_t avail = (loff_t)READ_ONCE(d_struct_ptr->ram_size) - *ppos;
+
+    if (READ_ONCE(d_struct_ptr->mode) == MYCDRV_MODE_FIFO)
+        return generic_file_splice_read(in, ppos, pipe, len, flags);
+    if (avail <= 0)
+        return 0;
+    return generic_file_splice_read(in, ppos, pipe, min_t(loff_t, len, avail), flags);
+}
+
+// zero a record whose copy failed, its space is reserved and must still be committed.
+static void mycdrv_log_pad(asp_mycdev *dev, loff_t pos, size_t len)
+{
+    struct page *page;
+    size_t offset, chunk;
+
+    while (len)
+    {
+        offset = offset_in_page(pos);
+        chunk = min_t(size_t, len, PAGE_SIZE - offset);
+        // holes already read as zeros, a page still shared with a snapshot gets its own copy first
+        page = NULL;
+        if (xa_load(&dev->pages, pos >> PAGE_SHIFT))
+            page = mycdrv_get_page_write(dev, pos >> PAGE_SHIFT);
+        if (page)
+        {
+            zero_user_segment(page, offset, offset + chunk);
+            mycdrv_crc_update(dev, pos >> PAGE_SHIFT, page);
+        }
+        pos += chunk;
+        len -= chunk;
+    }
+}
+
+// queue a written record and commit the records that now follow on from the committed end without a
+// gap. Whoever writes the oldest outstanding record commits the ones queued behind it, so an appender
+// killed while waiting loses nothing.
+static void mycdrv_log_commit(asp_mycdev *dev, struct mycdrv_log_rec *rec)
+{
+    struct mycdrv_log_rec *prev;
+    s64 old, committed;
+
+    spin_lock(&dev->log_lock);
+    // records mostly finish in reservation order, look for their place from the back
+    list_for_each_entry_reverse(prev, &dev->log_recs, node)
+    {
+        if (prev->start < rec->start)
+            break;
+    }
+    list_add(&rec->node, &prev->node);
+    old = committed = atomic64_read(&dev->log_committed);
+    while ((rec = list_first_entry_or_null(&dev->log_recs, struct mycdrv_log_rec, node)) && rec->start == committed)
+    {
+        committed = rec->end;
+        list_del(&rec->node);
+        kfree(rec);
+    }
+    // orders the records' data before the new watermark for readers loading it with acquire
+    if (committed != old)
+        atomic64_set_release(&dev->log_committed, committed);
+    spin_unlock(&dev->log_lock);
+
+    if (committed == old)
+        return;
+    mycdrv_extend_buf_size(dev, committed);
+    wake_up_all(&dev->commitq);
+    wake_up_interruptible(&dev->readq);
+}
+
+// log mode write: append the whole buffer as one record. Only O_APPEND writes are accepted, a write or
+// pwrite at a file position would silently land somewhere else. Appenders reserve their space with a
+// cmpxchg on the tail and copy in parallel, then commit in reservation order, so readers never see a
+// record before it and every record in front of it are complete.
+static ssize_t mycdrv_log_write(asp_mycdev *d_struct_ptr, struct kiocb *iocb, struct iov_iter *from)
+{
+    size_t lbuf = iov_iter_count(from);
+    struct mycdrv_range range;
+    struct mycdrv_log_rec *rec;
+    s64 pos;
+    ssize_t nbytes;
+    struct mycdrv_clock clk;
+    u64 latency;
+
+    if (!(iocb->ki_flags & IOCB_APPEND))
+        return -EINVAL;
+    if (!lbuf)
+        return 0;
+    mycdrv_clock_start(&clk, trace_mycdrv_write_enabled());
+    // committing may wait for slower appenders
+    if (iocb->ki_flags & IOCB_NOWAIT)
+        return -EAGAIN;
+    // allocated up front, nothing may fail between reserving and committing
+    rec = kmalloc(sizeof(*rec), GFP_KERNEL);
+    if (!rec)
+        return -ENOMEM;
+    if (down_read_killable(&d_struct_ptr->sem))
+    {
+        kfree(rec);
+        return -ERESTARTSYS;
+    }
+    // switched to another mode while we waited for the lock
+    if (d_struct_ptr->mode != MYCDRV_MODE_LOG)
+    {
+        up_read(&d_struct_ptr->sem);
+        kfree(rec);
+        return -EINVAL;
+    }
+    // a record is never split, one that doesn't fit fails whole
+    pos = atomic64_read(&d_struct_ptr->log_tail);
+    do
+    {
+        if (lbuf > d_struct_ptr->ram_size - pos)
+        {
+            up_read(&d_struct_ptr->sem);
+            kfree(rec);
+            return -ENOSPC;
+        }
+    } while (!atomic64_try_cmpxchg(&d_struct_ptr->log_tail, &pos, pos + lbuf));
+    rec->start = pos;
+    rec->end = pos + lbuf;
+
+    // the reserved bytes are ours alone, the range lock only keeps the compressor off them. Nothing
+    // may abort before the record is queued, or the appenders behind us would wait forever.
+    mycdrv_range_lock_uninterruptible(d_struct_ptr, &range, pos, pos + lbuf, true);
+    mycdrv_clock_locked(&clk);
+    nbytes = mycdrv_copy_from_iter(d_struct_ptr, pos, lbuf, from);
+    if (nbytes != lbuf)
+    {
+        mycdrv_log_pad(d_struct_ptr, pos, lbuf);
+        if (nbytes >= 0)
+            nbytes = -EFAULT;
+    }
+    mycdrv_range_unlock(d_struct_ptr, &range);
+
+    // if we are killed while appenders in front are still copying, the last of them commits our record.
+    // They hold the shared lock until then, so the log can't be reset under it.
+    mycdrv_log_commit(d_struct_ptr, rec);
+    wait_event_killable(d_struct_ptr->commitq, atomic64_read_acquire(&d_struct_ptr->log_committed) >= pos + lbuf);
+    up_read(&d_struct_ptr->sem);
+
+    if (nbytes > 0)
+        iocb->ki_pos = pos + nbytes;
+    latency = mycdrv_account_io(d_struct_ptr, true, nbytes, &clk);
+    trace_mycdrv_write(d_struct_ptr->dev_num, pos, lbuf, nbytes, latency);
+    return nbytes;
+}
+
+static ssize_t mycdrv_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+    asp_mycdev *d_struct_ptr = (asp_mycdev *)iocb->ki_filp->private_data;
+    s64 avail;
+
+    if (READ_ONCE(d_struct_ptr->mode) == MYCDRV_MODE_FIFO)
+        return mycdrv_fifo_read(d_struct_ptr, to, iocb->ki_filp->f_flags & O_NONBLOCK, iocb->ki_flags & IOCB_NOWAIT);
+    // a ring is only accessed through its mapping
+    if (READ_ONCE(d_struct_ptr->mode) == MYCDRV_MODE_RING)
+        return -EINVAL;
+    // a log is read like a ramdisk that ends at the last committed record
+    if (READ_ONCE(d_struct_ptr->mode) == MYCDRV_MODE_LOG)
+    {
+        avail = atomic64_read_acquire(&d_struct_ptr->log_committed) - iocb->ki_pos;
+        iov_iter_truncate(to, avail > 0 ? avail : 0);
+    }
+    return mycdrv_do_read(d_struct_ptr, &iocb->ki_pos, to, iocb->ki_flags & IOCB_NOWAIT);
+}
+
+static ssize_t mycdrv_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+    asp_mycdev *d_struct_ptr = (asp_mycdev *)iocb->ki_filp->private_data;
+
+    if (READ_ONCE(d_struct_ptr->mode) == MYCDRV_MODE_FIFO)
+        return mycdrv_fifo_write(d_struct_ptr, from, iocb->ki_filp->f_flags & O_NONBLOCK, iocb->ki_flags & IOCB_NOWAIT);
+    if (READ_ONCE(d_struct_ptr->mode) == MYCDRV_MODE_RING)
+        return -EINVAL;
+    if (READ_ONCE(d_struct_ptr->mode) == MYCDRV_MODE_LOG)
+        return mycdrv_log_write(d_struct_ptr, iocb, from);
+    return mycdrv_do_write(d_struct_ptr, &iocb->ki_pos, from, iocb->ki_flags & IOCB_NOWAIT);
+}
+
+// streams and rings have no file position, a ring also can't grow. Log readers seek, SEEK_END is
+// the committed end and growing makes room for more records.
+static bool mycdrv_seekable(asp_mycdev *dev)
+{
+    return READ_ONCE(dev->mode) == MYCDRV_MODE_RANDOM || READ_ONCE(dev->mode) == MYCDRV_MODE_LOG;
+}
+
+static loff_t mycdrv_llseek(struct file *file, loff_t offset, int parameter)
+{
+    loff_t temppos;
+    size_t new_size;
+    asp_mycdev *d_struct_ptr;
+    d_struct_ptr = (asp_mycdev *)file->private_data;
+    if (!mycdrv_seekable(d_struct_ptr))
+        return -ESPIPE;
+    // seeking only reads the sizes, growing the device below upgrades to the exclusive lock
+    if (down_read_interruptible(&d_struct_ptr->sem))
+        return -ERESTARTSYS;
+    // the mode may have changed before we got the lock, it can't while we hold it
+    if (!mycdrv_seekable(d_struct_ptr))
+    {
+        up_read(&d_struct_ptr->sem);
+        return -ESPIPE;
+    }
+    //setting the SEEK_END to the end of the data.
+    if (mycdrv_core_seek_pos(file->f_pos, offset, parameter, READ_ONCE(d_struct_ptr->buf_size), &temppos))
+    {
+        up_read(&d_struct_ptr->sem);
+        return -EINVAL;
+    }
+    // a snapshot keeps the size it was taken with
+    if (mycdrv_core_seek_grows(temppos, d_struct_ptr->ram_size) && d_struct_ptr->readonly)
+    {
+        up_read(&d_struct_ptr->sem);
+        return -EINVAL;
+    }
+    if (mycdrv_core_seek_grows(temppos, d_struct_ptr->ram_size))
+    {
+        up_read(&d_struct_ptr->sem);
+        if (down_write_killable(&d_struct_ptr->sem))
+            return -ERESTARTSYS;
+        // and so may the mode while the lock was dropped
+        if (!mycdrv_seekable(d_struct_ptr))
+        {
+            up_write(&d_struct_ptr->sem);
+            return -ESPIPE;
+        }
+        // recheck, another seeker may have grown the device while the lock was dropped
+        if (mycdrv_core_seek_grows(temppos, d_struct_ptr->ram_size))
+        {
+            //file->f_pos = ramdisk_size + offset - 1;
+            new_size = mycdrv_core_grow(d_struct_ptr->ram_size, mycdrv_grow_step(d_struct_ptr));
+
+            // the new page is a hole until it is written, so growing only extends the size
+            d_struct_ptr->ram_size = new_size;
+            this_cpu_inc(d_struct_ptr->stats->grows);
+            if (d_struct_ptr->disk)
+                set_capacity_and_notify(d_struct_ptr->disk, new_size >> SECTOR_SHIFT);
+        }
+        downgrade_write(&d_struct_ptr->sem);
+    }
+    //temppos = temppos < d_struct_ptr->ram_size ? temppos : d_struct_ptr->ram_size;
+    temppos = mycdrv_core_seek_clamp(temppos);
+    // if(flag){
+    //     file->f_pos = temppos_dispose;
+    //     pr_info("Seeking end to pos=%ld\n", (long)temppos_dispose);
+
+    // }else{
+    file->f_pos = temppos;
+    //}
+    this_cpu_inc(d_struct_ptr->stats->seeks);
+    trace_mycdrv_llseek(d_struct_ptr->dev_num, offset, parameter, temppos, d_struct_ptr->ram_size);
+    up_read(&d_struct_ptr->sem);
+    return temppos;
+}
+
+// execute one batch descriptor, returns bytes transferred or a negative errno.
+static ssize_t mycdrv_batch_one(const struct mycdrv_io_desc *desc)
+{
+    struct iovec iov;
+    struct iov_iter iter;
+    loff_t pos = desc->offset;
+    asp_mycdev *d_struct_ptr;
+    struct fd f;
+    ssize_t ret;
+
+    if (desc->offset > LLONG_MAX || desc->len > MAX_RW_COUNT)
+        return -EINVAL;
+    // the device is named by a file open on it, so the node's permissions and the open mode apply
+    // as they do for pread and pwrite
+    f = fdget(desc->fd);
+    if (!f.file)
+        return -EBADF;
+    ret = -EINVAL;
+    if (f.file->f_op != &mycdrv_fops)
+        goto out_fdput;
+    // the file holds a device reference until fdput
+    d_struct_ptr = f.file->private_data;
+    // descriptors address offsets, FIFO and ring devices have none
+    ret = -ESPIPE;
+    if (READ_ONCE(d_struct_ptr->mode) != MYCDRV_MODE_RANDOM)
+        goto out_fdput;
+
+    switch (desc->op)
+    {
+    case MYCDRV_OP_READ:
+        ret = -EBADF;
+        if (!(f.file->f_mode & FMODE_READ))
+            break;
+        ret = import_single_range(READ, u64_to_user_ptr(desc->buf), desc->len, &iov, &iter);
+        if (!ret)
+            ret = mycdrv_do_read(d_struct_ptr, &pos, &iter, false);
+        break;
+    case MYCDRV_OP_WRITE:
+        // a snapshot can't be opened for writing
+        ret = -EBADF;
+        if (!(f.file->f_mode & FMODE_WRITE))
+            break;
+        ret = import_single_range(WRITE, u64_to_user_ptr(desc->buf), desc->len, &iov, &iter);
+        if (!ret)
+            ret = mycdrv_do_write(d_struct_ptr, &pos, &iter, false);
+        break;
+    default:
+        ret = -EINVAL;
+        break;
+    }
+out_fdput:
+    fdput(f);
+    return ret;
+}
+
+// ASP_IO_BATCH: run an array of descriptors against any of the open devices in one kernel entry.
+static long mycdrv_io_batch(struct mycdrv_io_batch __user *ubatch)
+{
+    struct mycdrv_io_batch batch;
+    struct mycdrv_io_desc __user *udescs;
+    struct mycdrv_io_desc desc;
+    __s64 result;
+    u32 i;
+
+    if (copy_from_user(&batch, ubatch, sizeof(batch)))
+        return -EFAULT;
+    if (batch.flags || batch.count > MYCDRV_BATCH_MAX)
+        return -EINVAL;
+    udescs = u64_to_user_ptr(batch.descs);
+
+    for (i = 0; i < batch.count; i++)
+    {
+        if (copy_from_user(&desc, &udescs[i], sizeof(desc)))
+            return i ? i : -EFAULT;
+        result = mycdrv_batch_one(&desc);
+        if (put_user(result, &udescs[i].result))
+            return i ? i : -EFAULT;
+        // a pending signal aborts the rest of the batch, the executed entries are reported
+        if (result == -ERESTARTSYS)
+            return i ? i : -ERESTARTSYS;
+    }
+    return batch.count;
+}
+
+// zero the bytes [offset, offset + len), whole pages are released when punching a hole and cleared in place otherwise.
+// The block queue's discard and write zeroes pass killable false, the ioctls can be interrupted.
+static long mycdrv_do_zero_range(asp_mycdev *d_struct_ptr, u64 offset, u64 len, bool punch, bool killable)
+{
+    struct mycdrv_range range;
+    loff_t hole_start, hole_end, page_pos;
+    unsigned long index;
+    struct page *page;
+    void *entry;
+    unsigned int from, to;
+    bool punched = false;
+    long ret;
+
+    if (offset > LLONG_MAX || len > LLONG_MAX - offset)
+        return -EINVAL;
+    if (!len)
+        return 0;
+    if (!killable)
+        down_read(&d_struct_ptr->sem);
+    else if (down_read_killable(&d_struct_ptr->sem))
+        return -ERESTARTSYS;
+    ret = -ESPIPE;
+    if (d_struct_ptr->mode != MYCDRV_MODE_RANDOM)
+        goto out_unlock;
+    ret = -EINVAL;
+    if (offset + len > d_struct_ptr->ram_size)
+        goto out_unlock;
+    if (!killable)
+        mycdrv_range_lock_uninterruptible(d_struct_ptr, &range, offset, offset + len, true);
+    else if (mycdrv_range_lock(d_struct_ptr, &range, offset, offset + len, true))
+    {
+        ret = -ERESTARTSYS;
+        goto out_unlock;
+    }
+
+    // only the populated pages of the range need any work, holes already read as zeros
+    ret = 0;
+    xa_for_each_range(&d_struct_ptr->pages, index, entry, offset >> PAGE_SHIFT, (offset + len - 1) >> PAGE_SHIFT)
+    {
+        page_pos = (loff_t)index << PAGE_SHIFT;
+        from = max_t(loff_t, offset, page_pos) - page_pos;
+        to = min_t(loff_t, offset + len - page_pos, PAGE_SIZE);
+        if (punch && from == 0 && to == PAGE_SIZE)
+        {
+            // the zlock keeps a faulting decompressor off the entry
+            mutex_lock(&d_struct_ptr->zlock);
+            entry = xa_erase(&d_struct_ptr->pages, index);
+            if (mycdrv_is_zpage(entry))
+                mycdrv_free_zpage(d_struct_ptr, entry);
+            else if (entry)
+                mycdrv_release_page(entry);
+            mutex_unlock(&d_struct_ptr->zlock);
+            xa_erase(&d_struct_ptr->crcs, index);
+            punched = true;
+            continue;
+        }
+        page = mycdrv_lookup_page(d_struct_ptr, index);
+        if (IS_ERR(page))
+        {
+            ret = PTR_ERR(page);
+            break;
+        }
+        // a page shared with a snapshot is copied before it changes
+        if (page && xa_get_mark(&d_struct_ptr->pages, index, MYCDRV_SHARED))
+        {
+            page = mycdrv_get_page_write(d_struct_ptr, index);
+            if (!page)
+            {
+                ret = -ENOMEM;
+                break;
+            }
+        }
+        if (page)
+        {
+            zero_user_segment(page, from, to);
+            mycdrv_crc_update(d_struct_ptr, index, page);
+        }
+    }
+    mycdrv_range_unlock(d_struct_ptr, &range);
+
+    // user mappings of the released pages fault in fresh ones
+    hole_start = round_up(offset, PAGE_SIZE);
+    hole_end = round_down(offset + len, PAGE_SIZE);
+    if (punched && d_struct_ptr->mapping)
+        unmap_mapping_range(d_struct_ptr->mapping, hole_start, hole_end - hole_start, 1);
+out_unlock:
+    up_read(&d_struct_ptr->sem);
+    return ret;
+}
+
+// ASP_ZERO_RANGE and ASP_PUNCH_HOLE
+static long mycdrv_zero_range(asp_mycdev *d_struct_ptr, struct mycdrv_range_op __user *uarg, bool punch)
+{
+    struct mycdrv_range_op arg;
+
+    if (copy_from_user(&arg, uarg, sizeof(arg)))
+        return -EFAULT;
+    return mycdrv_do_zero_range(d_struct_ptr, arg.offset, arg.len, punch, true);
+}
+
+// copy the locked ranges page by page, returns the bytes copied or the error that stopped the first page.
+static long mycdrv_copy_pages(asp_mycdev *src, loff_t spos, asp_mycdev *dst, loff_t dpos, u64 len)
+{
+    struct page *spage, *dpage;
+    void *saddr, *daddr;
+    u64 done = 0;
+    size_t n;
+    long err = 0;
+
+    while (done < len)
+    {
+        n = min_t(u64, len - done, min(PAGE_SIZE - offset_in_page(spos), PAGE_SIZE - offset_in_page(dpos)));
+        spage = mycdrv_lookup_page(src, spos >> PAGE_SHIFT);
+        if (IS_ERR(spage))
+        {
+            err = PTR_ERR(spage);
+            break;
+        }
+        // a corrupt source page fails the copy like a read of it would
+        if (spage && src->integrity && !mycdrv_crc_verify(src, spos >> PAGE_SHIFT, spage, false))
+        {
+            err = -EIO;
+            break;
+        }
+        if (!spage)
+        {
+            // a hole copies as zeros, don't populate the destination for it
+            dpage = mycdrv_lookup_page(dst, dpos >> PAGE_SHIFT);
+            if (IS_ERR(dpage))
+            {
+                err = PTR_ERR(dpage);
+                break;
+            }
+            if (dpage && xa_get_mark(&dst->pages, dpos >> PAGE_SHIFT, MYCDRV_SHARED))
+            {
+                dpage = mycdrv_get_page_write(dst, dpos >> PAGE_SHIFT);
+                if (!dpage)
+                {
+                    err = -ENOMEM;
+                    break;
+                }
+            }
+            if (dpage)
+            {
+                zero_user_segment(dpage, offset_in_page(dpos), offset_in_page(dpos) + n);
+                mycdrv_crc_update(dst, dpos >> PAGE_SHIFT, dpage);
+            }
+        }
+        else
+        {
+            dpage = mycdrv_get_page_write(dst, dpos >> PAGE_SHIFT);
+            if (!dpage)
+            {
+                err = -ENOMEM;
+                break;
+            }
+            saddr = kmap_local_page(spage);
+            daddr = kmap_local_page(dpage);
+            memcpy(daddr + offset_in_page(dpos), saddr + offset_in_page(spos), n);
+            kunmap_local(daddr);
+            kunmap_local(saddr);
+            flush_dcache_page(dpage);
+            mycdrv_crc_update(dst, dpos >> PAGE_SHIFT, dpage);
+        }
+        spos += n;
+        dpos += n;
+        done += n;
+        cond_resched();
+    }
+    return done ? (long)done : err;
+}
+
+// ASP_COPY_RANGE: copy from the device open as src_fd into this device without a trip through user memory.
+static long mycdrv_copy_range(asp_mycdev *dst, struct mycdrv_copy_range __user *uarg)
+{
+    struct mycdrv_copy_range arg;
+    struct mycdrv_range src_range, dst_range;
+    asp_mycdev *src, *first, *second;
+    bool src_first;
+    struct fd f;
+    long ret;
+
+    if (copy_from_user(&arg, uarg, sizeof(arg)))
+        return -EFAULT;
+    if (arg.flags || arg.src_offset > LLONG_MAX || arg.dst_offset > LLONG_MAX ||
+        arg.len > LLONG_MAX - max(arg.src_offset, arg.dst_offset))
+        return -EINVAL;
+    if (!arg.len)
+        return 0;
+    // the source is a file open for reading, like for copy_file_range, so its node's permissions apply
+    f = fdget(arg.src_fd);
+    if (!f.file)
+        return -EBADF;
+    ret = -EBADF;
+    if (!(f.file->f_mode & FMODE_READ))
+        goto out_fdput;
+    ret = -EINVAL;
+    if (f.file->f_op != &mycdrv_fops)
+        goto out_fdput;
+    // the file holds a device reference until fdput
+    src = f.file->private_data;
+    if (src == dst && arg.src_offset < arg.dst_offset + arg.len && arg.dst_offset < arg.src_offset + arg.len)
+        goto out_fdput;
+    // with checksums the range locks cover whole pages, the two ranges must not even share one
+    if (src == dst && dst->integrity &&
+        round_down(arg.src_offset, PAGE_SIZE) < round_up(arg.dst_offset + arg.len, PAGE_SIZE) &&
+        round_down(arg.dst_offset, PAGE_SIZE) < round_up(arg.src_offset + arg.len, PAGE_SIZE))
+        goto out_fdput;
+
+    // two devices are always locked in dev_num order, their ranges too
+    src_first = src->dev_num < dst->dev_num;
+    first = src_first ? src : dst;
+    second = src_first ? dst : src;
+    ret = -ERESTARTSYS;
+    if (down_read_killable(&first->sem))
+        goto out_fdput;
+    if (second != first && down_read_killable(&second->sem))
+    {
+        up_read(&first->sem);
+        goto out_fdput;
+    }
+    ret = -ESPIPE;
+    if (src->mode != MYCDRV_MODE_RANDOM || dst->mode != MYCDRV_MODE_RANDOM)
+        goto out_unlock;
+    ret = -EINVAL;
+    if (arg.src_offset + arg.len > src->ram_size || arg.dst_offset + arg.len > dst->ram_size)
+        goto out_unlock;
+
+    // waiting for a range while holding another of the same device can deadlock with a waiting range
+    // that overlaps both, within one device a single range covers source and destination
+    if (src == dst)
+        ret = mycdrv_range_lock(dst, &dst_range, min(arg.src_offset, arg.dst_offset),
+                                max(arg.src_offset, arg.dst_offset) + arg.len, true);
+    else if (src_first)
+        ret = mycdrv_range_lock(src, &src_range, arg.src_offset, arg.src_offset + arg.len, false);
+    else
+        ret = mycdrv_range_lock(dst, &dst_range, arg.dst_offset, arg.dst_offset + arg.len, true);
+    if (ret)
+        goto out_unlock;
+    if (src != dst)
+    {
+        if (src_first)
+            ret = mycdrv_range_lock(dst, &dst_range, arg.dst_offset, arg.dst_offset + arg.len, true);
+        else
+            ret = mycdrv_range_lock(src, &src_range, arg.src_offset, arg.src_offset + arg.len, false);
+        if (ret)
+        {
+            mycdrv_range_unlock(first, src_first ? &src_range : &dst_range);
+            goto out_unlock;
+        }
+    }
+
+    ret = mycdrv_copy_pages(src, arg.src_offset, dst, arg.dst_offset, arg.len);
+    if (ret > 0)
+        mycdrv_extend_buf_size(dst, arg.dst_offset + ret);
+
+    mycdrv_range_unlock(dst, &dst_range);
+    if (src != dst)
+        mycdrv_range_unlock(src, &src_range);
+out_unlock:
+    if (second != first)
+        up_read(&second->sem);
+    up_read(&first->sem);
+out_fdput:
+    fdput(f);
+    return ret;
+}
+
+// check the file given to ASP_PERSIST or ASP_RESTORE, the device's own nodes would wait on its locks forever.
+// So would a file on a filesystem mounted from the device's block node: its I/O goes through
+// mycdrv_blk_rw, which waits for the range persist holds or the semaphore restore holds.
+static int mycdrv_backing_file(asp_mycdev *dev, struct file *file, fmode_t mode)
+{
+    struct inode *inode = file_inode(file);
+    struct block_device *bdev = inode->i_sb->s_bdev;
+
+    if (!(file->f_mode & mode))
+        return -EBADF;
+    if (file->f_op == &mycdrv_fops || (S_ISBLK(inode->i_mode) && I_BDEV(inode)->bd_disk->fops == &mycdrv_blk_fops))
+        return -EINVAL;
+    // the disk only goes away under the exclusive lock, comparing against a stale pointer is harmless
+    if (bdev && bdev->bd_disk == READ_ONCE(dev->disk))
+        return -EINVAL;
+    // holes in the image stand for holes in the device, that needs a file that can be truncated
+    if (!S_ISREG(inode->i_mode))
+        return -EINVAL;
+    return 0;
+}
+
+// take a reference on the populated page at index to write it out, NULL for a hole. A compressed
+// page is unpacked into a page of its own, writing out a cold device doesn't bring it back into memory.
+static struct page *mycdrv_persist_page(asp_mycdev *dev, pgoff_t index)
+{
+    struct page *page;
+    void *entry;
+    int err;
+
+    for (;;)
+    {
+        xa_lock(&dev->pages);
+        entry = xa_load(&dev->pages, index);
+        if (entry && !mycdrv_is_zpage(entry))
+            get_page(entry);
+        xa_unlock(&dev->pages);
+        if (!mycdrv_is_zpage(entry))
+            return entry;
+
+        page = alloc_page(GFP_KERNEL);
+        if (!page)
+            return ERR_PTR(-ENOMEM);
+        mutex_lock(&dev->zlock);
+        entry = xa_load(&dev->pages, index);
+        err = mycdrv_is_zpage(entry) ? mycdrv_unpack_zpage(dev, index, entry, page) : -EAGAIN;
+        mutex_unlock(&dev->zlock);
+        if (!err)
+            return page;
+        __free_page(page);
+        // decompressed by a fault in the meantime, take the page itself
+        if (err != -EAGAIN)
+            return ERR_PTR(err);
+    }
+}
+
+// write n pages at page index first of the image and drop their references.
+static int mycdrv_persist_chunk(struct file *file, struct bio_vec *bvec, unsigned int n, pgoff_t first)
+{
+    struct iov_iter iter;
+    loff_t pos = (loff_t)first << PAGE_SHIFT;
+    ssize_t ret = 0;
+
+    iov_iter_bvec(&iter, WRITE, bvec, n, (size_t)n << PAGE_SHIFT);
+    while (iov_iter_count(&iter))
+    {
+        ret = vfs_iter_write(file, &iter, &pos, 0);
+        if (ret <= 0)
+            break;
+    }
+    while (n--)
+        put_page(bvec[n].bv_page);
+    if (ret < 0)
+        return ret;
+    return iov_iter_count(&iter) ? -EIO : 0;
+}
+
+// ASP_PERSIST: write the device into a file at the same offsets. Only populated pages are written,
+// holes stay holes in the file, and the file ends where the device's data ends.
+static long mycdrv_persist(asp_mycdev *d_struct_ptr, struct mycdrv_persist __user *uarg)
+{
+    struct mycdrv_persist arg;
+    struct mycdrv_range range;
+    struct bio_vec *bvec;
+    struct page *page;
+    unsigned long index, next = 0, first = 0;
+    unsigned int n = 0;
+    void *entry;
+    struct fd f;
+    loff_t size;
+    long ret;
+
+    if (copy_from_user(&arg, uarg, sizeof(arg)))
+        return -EFAULT;
+    if (arg.flags)
+        return -EINVAL;
+    f = fdget(arg.fd);
+    if (!f.file)
+        return -EBADF;
+    ret = mycdrv_backing_file(d_struct_ptr, f.file, FMODE_WRITE);
+    if (ret)
+        goto out_fdput;
+    ret = -ENOMEM;
+    bvec = kmalloc_array(MYCDRV_PERSIST_PAGES, sizeof(*bvec), GFP_KERNEL);
+    if (!bvec)
+        goto out_fdput;
+
+    ret = -ERESTARTSYS;
+    if (down_read_killable(&d_struct_ptr->sem))
+        goto out_free;
+    ret = -ESPIPE;
+    if (d_struct_ptr->mode != MYCDRV_MODE_RANDOM)
+        goto out_unlock;
+    // readers carry on, writers wait so the image is consistent
+    ret = mycdrv_range_lock(d_struct_ptr, &range, 0, d_struct_ptr->ram_size, false);
+    if (ret)
+        goto out_unlock;
+    // whatever the file held before must not show through the holes
+    ret = vfs_truncate(&f.file->f_path, 0);
+    if (ret)
+        goto out_range;
+
+    xa_for_each(&d_struct_ptr->pages, index, entry)
+    {
+        // one call per run of contiguous pages
+        if (n && (index != next || n == MYCDRV_PERSIST_PAGES))
+        {
+            ret = mycdrv_persist_chunk(f.file, bvec, n, first);
+            n = 0;
+            if (ret)
+                break;
+        }
+        page = mycdrv_persist_page(d_struct_ptr, index);
+        if (IS_ERR(page))
+        {
+            ret = PTR_ERR(page);
+            break;
+        }
+        if (!page)
+            continue;
+        if (!n)
+            first = index;
+        bvec[n].bv_page = page;
+        bvec[n].bv_len = PAGE_SIZE;
+        bvec[n].bv_offset = 0;
+        n++;
+        next = index + 1;
+        cond_resched();
+    }
+    if (n && !ret)
+        ret = mycdrv_persist_chunk(f.file, bvec, n, first);
+    else
+    {
+        while (n--)
+            put_page(bvec[n].bv_page);
+    }
+
+    size = READ_ONCE(d_struct_ptr->buf_size);
+    if (!ret)
+        ret = vfs_truncate(&f.file->f_path, size);
+    if (!ret)
+        ret = size;
+out_range:
+    mycdrv_range_unlock(d_struct_ptr, &range);
+out_unlock:
+    up_read(&d_struct_ptr->sem);
+out_free:
+    kfree(bvec);
+out_fdput:
+    fdput(f);
+    return ret;
+}
+
+// read the pages [start, end) of the image into the device, pages that read back as zeros stay holes.
+static int mycdrv_restore_extent(asp_mycdev *dev, struct file *file, struct bio_vec *bvec, pgoff_t start, pgoff_t end)
+{
+    struct iov_iter iter;
+    unsigned int n, i;
+    loff_t pos;
+    size_t got, bytes;
+    ssize_t ret;
+    void *addr;
+    int err = 0;
+
+    while (!err && start < end)
+    {
+        n = min_t(pgoff_t, end - start, MYCDRV_PERSIST_PAGES);
+        for (i = 0; i < n; i++)
+        {
+            bvec[i].bv_page = alloc_pages_node(mycdrv_page_node(dev, start + i), GFP_KERNEL, 0);
+            if (!bvec[i].bv_page)
+                break;
+            bvec[i].bv_len = PAGE_SIZE;
+            bvec[i].bv_offset = 0;
+        }
+        if (i < n)
+        {
+            while (i--)
+                __free_page(bvec[i].bv_page);
+            return -ENOMEM;
+        }
+
+        pos = (loff_t)start << PAGE_SHIFT;
+        iov_iter_bvec(&iter, READ, bvec, n, (size_t)n << PAGE_SHIFT);
+        while (iov_iter_count(&iter))
+        {
+            ret = vfs_iter_read(file, &iter, &pos, 0);
+            if (ret <= 0)
+            {
+                if (ret < 0)
+                    err = ret;
+                break;
+            }
+        }
+        got = ((size_t)n << PAGE_SHIFT) - iov_iter_count(&iter);
+
+        for (i = 0; i < n; i++)
+        {
+            struct page *page = bvec[i].bv_page;
+
+            bytes = min_t(size_t, got, PAGE_SIZE);
+            got -= bytes;
+            // the file ended early, the rest of the page reads as zeros
+            if (bytes && bytes < PAGE_SIZE)
+                zero_user_segment(page, bytes, PAGE_SIZE);
+            addr = kmap_local_page(page);
+            if (bytes)
+                bytes = memchr_inv(addr, 0, PAGE_SIZE) ? bytes : 0;
+            kunmap_local(addr);
+            if (!bytes || err)
+            {
+                __free_page(page);
+                continue;
+            }
+            err = xa_err(xa_store(&dev->pages, start + i, page, GFP_KERNEL));
+            if (err)
+                __free_page(page);
+            else
+                mycdrv_crc_update(dev, start + i, page);
+        }
+        // read faults don't take the semaphore, they may have mapped the zero page over these holes
+        smp_mb();
+        if (dev->mapping)
+            unmap_mapping_range(dev->mapping, (loff_t)start << PAGE_SHIFT, (loff_t)n << PAGE_SHIFT, 0);
+        start += n;
+        cond_resched();
+    }
+    return err;
+}
+
+// ASP_RESTORE: replace the contents of the device with an image written by ASP_PERSIST. Only the data
+// regions of the file are read, the device grows if the image is larger. The file offset is left undefined.
+static long mycdrv_restore(asp_mycdev *d_struct_ptr, struct file *file, struct mycdrv_persist __user *uarg)
+{
+    struct mycdrv_persist arg;
+    struct bio_vec *bvec;
+    loff_t size, pos, data, hole;
+    struct fd f;
+    long ret;
+
+    if (copy_from_user(&arg, uarg, sizeof(arg)))
+        return -EFAULT;
+    if (arg.flags)
+        return -EINVAL;
+    f = fdget(arg.fd);
+    if (!f.file)
+        return -EBADF;
+    ret = mycdrv_backing_file(d_struct_ptr, f.file, FMODE_READ);
+    if (ret)
+        goto out_fdput;
+    ret = -ENOMEM;
+    bvec = kmalloc_array(MYCDRV_PERSIST_PAGES, sizeof(*bvec), GFP_KERNEL);
+    if (!bvec)
+        goto out_fdput;
+
+    ret = -ERESTARTSYS;
+    if (down_write_killable(&d_struct_ptr->sem))
+        goto out_free;
+    ret = -ESPIPE;
+    if (d_struct_ptr->mode != MYCDRV_MODE_RANDOM)
+        goto out_unlock;
+    size = i_size_read(file_inode(f.file));
+    if (size > d_struct_ptr->ram_size)
+    {
+        d_struct_ptr->ram_size = round_up(size, mycdrv_grow_step(d_struct_ptr));
+        this_cpu_inc(d_struct_ptr->stats->grows);
+        if (d_struct_ptr->disk)
+            set_capacity_and_notify(d_struct_ptr->disk, d_struct_ptr->ram_size >> SECTOR_SHIFT);
+    }
+    mycdrv_free_pages(d_struct_ptr);
+
+    ret = 0;
+    for (pos = 0; pos < size; pos = hole)
+    {
+        // file systems without SEEK_DATA report the whole file as data
+        data = vfs_llseek(f.file, pos, SEEK_DATA);
+        if (data == -ENXIO)
+            break;
+        hole = data < 0 ? data : vfs_llseek(f.file, data, SEEK_HOLE);
+        if (hole < 0)
+        {
+            ret = hole;
+            break;
+        }
+        hole = min(hole, size);
+        ret = mycdrv_restore_extent(d_struct_ptr, f.file, bvec, data >> PAGE_SHIFT, DIV_ROUND_UP(hole, PAGE_SIZE));
+        if (ret)
+            break;
+        hole = round_up(hole, PAGE_SIZE);
+    }
+    // a failed restore leaves the device empty rather than half filled
+    if (ret)
+    {
+        mycdrv_free_pages(d_struct_ptr);
+        size = 0;
+    }
+    file->f_pos = 0;
+    spin_lock(&d_struct_ptr->size_lock);
+    d_struct_ptr->buf_size = size;
+    spin_unlock(&d_struct_ptr->size_lock);
+    if (!ret)
+        ret = size;
+out_unlock:
+    up_write(&d_struct_ptr->sem);
+out_free:
+    kfree(bvec);
+out_fdput:
+    fdput(f);
+    return ret;
+}
+
+// ASP_SCRUB: verify every resident page that has a checksum, returns the number of mismatches. Compressed
+// pages are left alone, they are verified when an access decompresses them. The device lock is taken
+// for one page at a time, so a scrub of a large device doesn't hold up growing, clearing or a mode change.
+static long mycdrv_scrub(asp_mycdev *d_struct_ptr)
+{
+    struct mycdrv_range range;
+    unsigned long index;
+    void *entry, *page;
+    long bad = 0;
+    int err = 0;
+
+    if (!d_struct_ptr->integrity)
+        return -EINVAL;
+    // the walk itself needs no lock, pages cleared in between just drop out of it
+    xa_for_each(&d_struct_ptr->crcs, index, entry)
+    {
+        if (down_read_killable(&d_struct_ptr->sem))
+        {
+            err = -ERESTARTSYS;
+            break;
+        }
+        // writers of the page finish first, they update the checksum
+        err = mycdrv_range_lock(d_struct_ptr, &range, (loff_t)index << PAGE_SHIFT, (loff_t)(index + 1) << PAGE_SHIFT, false);
+        if (err)
+        {
+            up_read(&d_struct_ptr->sem);
+            break;
+        }
+        page = xa_load(&d_struct_ptr->pages, index);
+        if (page && !mycdrv_is_zpage(page))
+        {
+            if (!mycdrv_crc_verify(d_struct_ptr, index, page, true))
+                bad++;
+            this_cpu_inc(d_struct_ptr->stats->crc_scrubbed);
+        }
+        mycdrv_range_unlock(d_struct_ptr, &range);
+        up_read(&d_struct_ptr->sem);
+        cond_resched();
+    }
+    return err ? err : bad;
+}
+
+// the commands that change the contents or the mode of a device
+static bool mycdrv_ioctl_modifies(unsigned int cmd)
+{
+    return cmd == ASP_CLEAR_BUF || cmd == ASP_SET_MODE || cmd == ASP_ZERO_RANGE || cmd == ASP_PUNCH_HOLE ||
+           cmd == ASP_COPY_RANGE || cmd == ASP_RESTORE;
+}
+
+static long mycdrv_ioctl(struct file *file, unsigned int cmd, unsigned long direction)
+{
+	asp_mycdev* d_struct_ptr;
+	long ret = 0;
+	u64 start = trace_mycdrv_ioctl_enabled() ? ktime_get_ns() : 0;
+	d_struct_ptr = (asp_mycdev*)file->private_data;
+
+	// a snapshot's contents never change
+	if (d_struct_ptr->readonly && mycdrv_ioctl_modifies(cmd))
+		return -EROFS;
+	// commands that change the contents need a file open for writing, as write(2) does, and
+	// saving them to a backing file needs one open for reading, as read(2) does
+	if (!(file->f_mode & FMODE_WRITE) && mycdrv_ioctl_modifies(cmd))
+		return -EBADF;
+	if (!(file->f_mode & FMODE_READ) && cmd == ASP_PERSIST)
+		return -EBADF;
+
+	switch(cmd)
+	{
+		case ASP_CLEAR_BUF:
+			if (down_write_killable(&d_struct_ptr->sem))
+				return -ERESTARTSYS;
+            // Reset the device memory, released pages read back as zeros
+			mycdrv_free_pages(d_struct_ptr);
+            //set position to 0.
+			file->f_pos = 0;
+            spin_lock(&d_struct_ptr->size_lock);
+            d_struct_ptr->buf_size = 0;
+            spin_unlock(&d_struct_ptr->size_lock);
+            // an emptied stream has room for the writers again
+            d_struct_ptr->fifo_head = 0;
+            d_struct_ptr->fifo_tail = 0;
+            // no appender is between reserving and committing while we hold the exclusive lock
+            atomic64_set(&d_struct_ptr->log_tail, 0);
+            atomic64_set(&d_struct_ptr->log_committed, 0);
+            if (d_struct_ptr->ring_page)
+            {
+                struct mycdrv_ring_ctrl *ctrl = page_address(d_struct_ptr->ring_page);
+
+                WRITE_ONCE(ctrl->producer, 0);
+                WRITE_ONCE(ctrl->consumer, 0);
+            }
+			up_write(&d_struct_ptr->sem);
+            wake_up_interruptible_all(&d_struct_ptr->writeq);
+			break;
+
+		case ASP_SET_MODE:
+			ret = mycdrv_set_mode(d_struct_ptr, file, (int)direction);
+			break;
+
+		case ASP_RING_WAIT:
+			ret = mycdrv_ring_wait(d_struct_ptr);
+			break;
+
+		case ASP_RING_KICK:
+			if (READ_ONCE(d_struct_ptr->mode) != MYCDRV_MODE_RING)
+				ret = -EINVAL;
+			else
+				wake_up_interruptible(&d_struct_ptr->readq);
+			break;
+
+		case ASP_ZERO_RANGE:
+		case ASP_PUNCH_HOLE:
+			ret = mycdrv_zero_range(d_struct_ptr, (struct mycdrv_range_op __user *)direction, cmd == ASP_PUNCH_HOLE);
+			break;
+
+		case ASP_COPY_RANGE:
+			ret = mycdrv_copy_range(d_struct_ptr, (struct mycdrv_copy_range __user *)direction);
+			break;
+
+		case ASP_PERSIST:
+			ret = mycdrv_persist(d_struct_ptr, (struct mycdrv_persist __user *)direction);
+			break;
+
+		case ASP_RESTORE:
+			ret = mycdrv_restore(d_struct_ptr, file, (struct mycdrv_persist __user *)direction);
+			break;
+
+		case ASP_IO_BATCH:
+			ret = mycdrv_io_batch((struct mycdrv_io_batch __user *)direction);
+			break;
+
+		case ASP_SCRUB:
+			ret = mycdrv_scrub(d_struct_ptr);
+			break;
+
+		default:
+			ret = -ENOTTY;
+			break;
+	}
+
+	trace_mycdrv_ioctl(d_struct_ptr->dev_num, cmd, ret, start ? ktime_get_ns() - start : 0);
+	return ret;
+}
+
+static void __exit my_exit(void)
+{
+    pr_info("EXIT: Unregistering Character Device\n");
+    mycdrv_kunit_exit();
+
+    // deallocate each device's ramdisk, cdev, and device
+    mycdrv_remove_all();
+    device_destroy(mycdrv_class, MKDEV(major_num, MYCDRV_CTL_MINOR));
+    cdev_del(&mycdrv_ctl_cdev);
+    unregister_blkdev(mycdrv_blk_major, DEVICE_NAME);
+    debugfs_remove_recursive(mycdrv_debugfs_root);
+    xa_destroy(&mycdrv_devices);
+    pr_info("EXIT: Deallocated devices\n");
+
+    class_destroy(mycdrv_class);
+    pr_info("EXIT: Destroyed class blueprint\n");
+
+    unregister_chrdev_region(maj_min, MYCDRV_MINORS);
+    pr_info("EXIT: Unregistered device regions\n");
+}
+
+// module exit
+module_exit(my_exit);
+
+#ifdef MYCDRV_KUNIT
+#include "mycdrv_kunit.c"
+#else
+static void mycdrv_kunit_init(void)
+{
+}
+
+static void mycdrv_kunit_exit(void)
+{
+}
+#endif
 
 
 
@@ -0,0 +1,364 @@
+//Author - Venkata Sai Gireesh Chamarthi
+// Multi-threaded throughput and latency benchmark for the mycdrv devices.
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEVICE "/dev/mycdrv"
+
+#ifdef MYCDRV_USER
+// built against libmycdrv (make bench-user): the devices live in this process and the I/O runs the
+// driver's page store, range locks and copies from mycdrv_core.c without a kernel. The read_iter and
+// write_iter entry points, the stats and the optional features of char_driver.c aren't part of it.
+// -p and -f are ignored
+#include "mycdrv_user.h"
+
+static struct mycdrv_user_dev **udevs;
+
+static int dev_setup(int devices, size_t region)
+{
+	int d;
+
+	udevs = calloc(devices, sizeof(*udevs));
+	if (!udevs)
+		return -1;
+	for (d = 0; d < devices; d++) {
+		udevs[d] = mycdrv_user_create(region);
+		if (!udevs[d])
+			return -1;
+	}
+	return 0;
+}
+
+static int dev_open(const char *path, int d)
+{
+	(void)path;
+	return d;
+}
+
+static ssize_t dev_pread(int h, void *buf, size_t len, off_t off)
+{
+	loff_t pos = off;
+
+	return mycdrv_user_read(udevs[h], buf, len, &pos);
+}
+
+static ssize_t dev_pwrite(int h, const void *buf, size_t len, off_t off)
+{
+	loff_t pos = off;
+
+	return mycdrv_user_write(udevs[h], buf, len, &pos);
+}
+
+static void dev_close(int h)
+{
+	(void)h;
+}
+#else
+static int dev_setup(int devices, size_t region)
+{
+	(void)devices;
+	(void)region;
+	return 0;
+}
+
+static int dev_open(const char *path, int d)
+{
+	(void)d;
+	return open(path, O_RDWR);
+}
+
+// pread/pwrite keep the seek out of the measured path
+#define dev_pread pread
+#define dev_pwrite pwrite
+#define dev_close close
+#endif
+
+// latency histogram: 32 linear sub-buckets per power of two nanoseconds, about 3% resolution
+#define SUB_BITS 5
+#define SUB_BUCKETS (1 << SUB_BITS)
+#define HIST_BUCKETS (64 * SUB_BUCKETS)
+
+struct hist {
+	uint64_t count[HIST_BUCKETS];
+	uint64_t ops; // complete transfers of the block size, the histogram holds their latency
+	uint64_t bytes;
+	uint64_t errors;
+	uint64_t shorts; // transfers of less than the block size, e.g. past the end of a device smaller than -z
+};
+
+struct config {
+	int threads;
+	size_t block_size;
+	int read_pct;
+	int random;
+	int devices;
+	int first_device;
+	size_t region;
+	double seconds;
+	const char *prefix;
+};
+
+struct worker {
+	pthread_t tid;
+	int id;
+	const struct config *cfg;
+	struct hist rd;
+	struct hist wr;
+};
+
+static volatile int stop;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int hist_index(uint64_t ns)
+{
+	int msb;
+
+	if (ns < SUB_BUCKETS)
+		return (int)ns;
+	msb = 63 - __builtin_clzll(ns);
+	return (msb - SUB_BITS + 1) * SUB_BUCKETS + (int)((ns >> (msb - SUB_BITS)) & (SUB_BUCKETS - 1));
+}
+
+// lower bound of the values counted in a histogram bucket
+static uint64_t hist_value(int idx)
+{
+	int shift = idx / SUB_BUCKETS;
+
+	if (shift == 0)
+		return idx;
+	return (uint64_t)(SUB_BUCKETS + idx % SUB_BUCKETS) << (shift - 1);
+}
+
+static void hist_add(struct hist *dst, const struct hist *src)
+{
+	int i;
+
+	for (i = 0; i < HIST_BUCKETS; i++)
+		dst->count[i] += src->count[i];
+	dst->ops += src->ops;
+	dst->bytes += src->bytes;
+	dst->errors += src->errors;
+	dst->shorts += src->shorts;
+}
+
+static uint64_t hist_percentile(const struct hist *h, double pct)
+{
+	uint64_t want = (uint64_t)(h->ops * pct / 100.0), seen = 0;
+	int i;
+
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		seen += h->count[i];
+		if (seen > want)
+			return hist_value(i);
+	}
+	return 0;
+}
+
+// xorshift, every thread has its own state so the generator never becomes a shared cacheline
+static uint64_t next_rand(uint64_t *state)
+{
+	uint64_t x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	return *state = x;
+}
+
+static void *worker_main(void *arg)
+{
+	struct worker *w = arg;
+	const struct config *cfg = w->cfg;
+	uint64_t seed = 0x9e3779b97f4a7c15ull * (w->id + 1);
+	size_t slots = cfg->region / cfg->block_size;
+	uint64_t seq = (uint64_t)w->id * slots / cfg->threads;
+	char path[256];
+	char *buf;
+	int *fds;
+	int d;
+
+	fds = calloc(cfg->devices, sizeof(*fds));
+	if (posix_memalign((void **)&buf, 4096, cfg->block_size) || !fds) {
+		fprintf(stderr, "thread %d: out of memory\n", w->id);
+		exit(1);
+	}
+	memset(buf, 'a' + w->id % 26, cfg->block_size);
+	for (d = 0; d < cfg->devices; d++) {
+		snprintf(path, sizeof(path), "%s%d", cfg->prefix, cfg->first_device + d);
+		fds[d] = dev_open(path, d);
+		if (fds[d] == -1) {
+			fprintf(stderr, "open %s: %s\n", path, strerror(errno));
+			exit(1);
+		}
+	}
+
+	while (!stop) {
+		int dev = cfg->devices > 1 ? (int)(next_rand(&seed) % cfg->devices) : 0;
+		int is_read = (int)(next_rand(&seed) % 100) < cfg->read_pct;
+		uint64_t slot = cfg->random ? next_rand(&seed) % slots : seq++ % slots;
+		off_t off = (off_t)(slot * cfg->block_size);
+		struct hist *h = is_read ? &w->rd : &w->wr;
+		uint64_t start = now_ns(), end;
+		ssize_t ret;
+
+		if (is_read)
+			ret = dev_pread(fds[dev], buf, cfg->block_size, off);
+		else
+			ret = dev_pwrite(fds[dev], buf, cfg->block_size, off);
+		end = now_ns();
+		// only complete transfers count as operations, a failed or short one would inflate ops/s
+		if (ret < 0) {
+			h->errors++;
+			continue;
+		}
+		h->bytes += ret;
+		if ((size_t)ret != cfg->block_size) {
+			h->shorts++;
+			continue;
+		}
+		h->count[hist_index(end - start)]++;
+		h->ops++;
+	}
+
+	for (d = 0; d < cfg->devices; d++)
+		dev_close(fds[d]);
+	free(fds);
+	free(buf);
+	return NULL;
+}
+
+static void report(const char *name, const struct hist *h, double secs)
+{
+	if (!h->ops && !h->errors && !h->shorts)
+		return;
+	printf("%-6s %12.0f ops/s %10.2f MB/s  p50 %8llu ns  p99 %8llu ns  p999 %8llu ns  errors %llu  short %llu\n",
+	       name, h->ops / secs, h->bytes / secs / 1e6,
+	       (unsigned long long)hist_percentile(h, 50.0),
+	       (unsigned long long)hist_percentile(h, 99.0),
+	       (unsigned long long)hist_percentile(h, 99.9),
+	       (unsigned long long)h->errors, (unsigned long long)h->shorts);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-t threads] [-b block_size] [-r read_percent] [-m seq|rand]\n"
+		"          [-d devices] [-f first_device] [-z region_size] [-s seconds] [-p prefix]\n"
+		"  -t  worker threads (default 1)\n"
+		"  -b  bytes per read or write (default 4096)\n"
+		"  -r  percentage of reads, the rest are writes (default 50)\n"
+		"  -m  sequential or random offsets (default seq)\n"
+		"  -d  number of devices to spread the operations over (default 1)\n"
+		"  -f  index of the first device, /dev/mycdrv<f> (default 0)\n"
+		"  -z  bytes of each device to use, at most its ramdisk size (default 65536)\n"
+		"  -s  run time in seconds (default 5)\n"
+		"  -p  device path prefix (default " DEVICE ")\n", prog);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	struct config cfg = {
+		.threads = 1,
+		.block_size = 4096,
+		.read_pct = 50,
+		.random = 0,
+		.devices = 1,
+		.first_device = 0,
+		.region = 65536,
+		.seconds = 5,
+		.prefix = DEVICE,
+	};
+	struct hist *rd, *wr, *all;
+	struct worker *workers;
+	uint64_t start, elapsed;
+	double secs;
+	int opt, i;
+
+	while ((opt = getopt(argc, argv, "t:b:r:m:d:f:z:s:p:h")) != -1) {
+		switch (opt) {
+		case 't': cfg.threads = atoi(optarg); break;
+		case 'b': cfg.block_size = strtoul(optarg, NULL, 0); break;
+		case 'r': cfg.read_pct = atoi(optarg); break;
+		case 'm':
+			if (!strcmp(optarg, "rand"))
+				cfg.random = 1;
+			else if (strcmp(optarg, "seq"))
+				usage(argv[0]);
+			break;
+		case 'd': cfg.devices = atoi(optarg); break;
+		case 'f': cfg.first_device = atoi(optarg); break;
+		case 'z': cfg.region = strtoul(optarg, NULL, 0); break;
+		case 's': cfg.seconds = atof(optarg); break;
+		case 'p': cfg.prefix = optarg; break;
+		default: usage(argv[0]);
+		}
+	}
+	if (cfg.threads < 1 || cfg.devices < 1 || cfg.block_size == 0 ||
+	    cfg.region < cfg.block_size || cfg.read_pct < 0 || cfg.read_pct > 100 ||
+	    cfg.seconds <= 0)
+		usage(argv[0]);
+
+	workers = calloc(cfg.threads, sizeof(*workers));
+	rd = calloc(1, sizeof(*rd));
+	wr = calloc(1, sizeof(*wr));
+	all = calloc(1, sizeof(*all));
+	if (!workers || !rd || !wr || !all || dev_setup(cfg.devices, cfg.region)) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	printf("threads %d  block %zu  reads %d%%  %s  devices %d  region %zu  time %.1fs\n",
+	       cfg.threads, cfg.block_size, cfg.read_pct, cfg.random ? "random" : "sequential",
+	       cfg.devices, cfg.region, cfg.seconds);
+
+	start = now_ns();
+	for (i = 0; i < cfg.threads; i++) {
+		workers[i].id = i;
+		workers[i].cfg = &cfg;
+		if (pthread_create(&workers[i].tid, NULL, worker_main, &workers[i])) {
+			fprintf(stderr, "pthread_create failed\n");
+			return 1;
+		}
+	}
+	usleep((useconds_t)(cfg.seconds * 1e6));
+	stop = 1;
+	for (i = 0; i < cfg.threads; i++) {
+		pthread_join(workers[i].tid, NULL);
+		hist_add(rd, &workers[i].rd);
+		hist_add(wr, &workers[i].wr);
+	}
+	elapsed = now_ns() - start;
+	secs = elapsed / 1e9;
+
+	hist_add(all, rd);
+	hist_add(all, wr);
+	report("read", rd, secs);
+	report("write", wr, secs);
+	report("total", all, secs);
+	if (all->shorts)
+		fprintf(stderr, "warning: %llu transfers were short, is -z larger than the devices?\n",
+			(unsigned long long)all->shorts);
+
+	free(all);
+	free(wr);
+	free(rd);
+	free(workers);
+	return 0;
+}
@@ -0,0 +1,350 @@
+//Author - Venkata Sai Gireesh Chamarthi
+// page store and byte range locks of a mycdrv device, compiled into char_driver.c and into the user space
+// build in mycdrv_user.c. It isn't a translation unit of its own: the includer defines asp_mycdev with the
+// fields used here (pages, range_lock, ranges, rangeq, size_lock, buf_size, mapping, huge, integrity) and
+// the hooks mycdrv_page_node, mycdrv_is_zpage, mycdrv_decompress_page, mycdrv_fill_huge, mycdrv_crc_update
+// and mycdrv_crc_verify, and the kernel API comes from the kernel or from mycdrv_shim.h.
+
+// marks a page of the index that is shared with a snapshot, it is copied before it is written
+#define MYCDRV_SHARED XA_MARK_1
+
+// a byte range [start, end) held by a read or write in progress, or waiting for the ranges in front of it
+struct mycdrv_range
+{
+    struct list_head node;
+    loff_t start;
+    loff_t end;
+    bool write;
+    bool waiting; // cleared under range_lock when the range gets the lock
+};
+
+// keep a page warm for the compression scan
+static void mycdrv_touch_page(struct page *page)
+{
+    if (!PageReferenced(page))
+        SetPageReferenced(page);
+}
+
+// mycdrv_touch_page for a page found in the index without a reference. The fault path doesn't hold the
+// range lock, so the compressor may swap the page out and free it under us: pin it first and only mark
+// it if it is still in the index, the compressor skips pages with an extra reference.
+static void mycdrv_touch_entry(asp_mycdev *dev, pgoff_t index, struct page *page)
+{
+    if (PageReferenced(page) || !get_page_unless_zero(page))
+        return;
+    if (xa_load(&dev->pages, index) == page)
+        SetPageReferenced(page);
+    put_page(page);
+}
+
+// look up the backing page of a page index, NULL means a hole which reads back as zeros.
+static struct page *mycdrv_lookup_page(asp_mycdev *dev, pgoff_t index)
+{
+    void *entry = xa_load(&dev->pages, index);
+
+    if (mycdrv_is_zpage(entry))
+        return mycdrv_decompress_page(dev, index);
+    if (entry)
+        mycdrv_touch_entry(dev, index, entry);
+    return entry;
+}
+
+// get the backing page of a page index, allocating a zeroed page on first touch.
+static struct page *mycdrv_get_page(asp_mycdev *dev, pgoff_t index)
+{
+    struct page *page, *old;
+
+    page = mycdrv_lookup_page(dev, index);
+    if (IS_ERR(page))
+        return NULL;
+    if (page)
+        return page;
+
+    if (dev->huge && mycdrv_fill_huge(dev, index))
+    {
+        page = mycdrv_lookup_page(dev, index);
+        if (IS_ERR(page))
+            return NULL;
+        if (page)
+            return page;
+    }
+
+    // the node is a preference, a full node falls back to its neighbours
+    page = alloc_pages_node(mycdrv_page_node(dev, index), GFP_KERNEL | __GFP_ZERO, 0);
+    if (!page)
+        return NULL;
+    mycdrv_touch_page(page);
+
+    // somebody else may have populated the slot in the meantime, keep theirs.
+    old = xa_cmpxchg(&dev->pages, index, NULL, page, GFP_KERNEL);
+    if (old)
+    {
+        __free_page(page);
+        return xa_is_err(old) ? NULL : old;
+    }
+    // read faults map the zero page over holes, they must fault in the new page. The barrier pairs
+    // with the one in the fault: either it sees the page or we see its pte.
+    smp_mb();
+    if (dev->mapping)
+        unmap_mapping_range(dev->mapping, (loff_t)index << PAGE_SHIFT, PAGE_SIZE, 0);
+    return page;
+}
+
+// drop the ramdisk reference of a page that has been removed from the index.
+static void mycdrv_release_page(struct page *page)
+{
+    // taking the page lock waits for a racing fault or page_mkwrite to finish, both recheck
+    // the index under the lock so they can't map or accept the page afterwards.
+    lock_page(page);
+    ClearPageDirty(page);
+    unlock_page(page);
+    put_page(page);
+}
+
+// get the page to write at index. A page still shared with a snapshot is replaced by a private copy
+// first, the snapshot keeps the original.
+static struct page *mycdrv_get_page_write(asp_mycdev *dev, pgoff_t index)
+{
+    struct page *page, *copy;
+    void *old;
+    bool shared;
+
+    for (;;)
+    {
+        page = mycdrv_get_page(dev, index);
+        if (!page)
+            return NULL;
+        xa_lock(&dev->pages);
+        old = xa_load(&dev->pages, index);
+        shared = old == page && xa_get_mark(&dev->pages, index, MYCDRV_SHARED);
+        // the snapshots that held the page are gone, it is ours again
+        if (shared && page_count(page) == 1)
+        {
+            __xa_clear_mark(&dev->pages, index, MYCDRV_SHARED);
+            shared = false;
+        }
+        if (shared)
+            get_page(page);
+        xa_unlock(&dev->pages);
+        // replaced under us, look again
+        if (old != page)
+            continue;
+        if (!shared)
+            return page;
+
+        copy = alloc_pages_node(mycdrv_page_node(dev, index), GFP_KERNEL, 0);
+        if (!copy)
+        {
+            put_page(page);
+            return NULL;
+        }
+        copy_highpage(copy, page);
+        mycdrv_touch_page(copy);
+        xa_lock(&dev->pages);
+        // replacing a present entry doesn't allocate
+        old = __xa_cmpxchg(&dev->pages, index, page, copy, GFP_ATOMIC);
+        if (old == page)
+            __xa_clear_mark(&dev->pages, index, MYCDRV_SHARED);
+        xa_unlock(&dev->pages);
+        if (old == page)
+        {
+            mycdrv_release_page(page);
+            // mappings of the shared page must not see the write, they fault in the copy
+            if (dev->mapping)
+                unmap_mapping_range(dev->mapping, (loff_t)index << PAGE_SHIFT, PAGE_SIZE, 0);
+        }
+        else
+        {
+            // another writer copied it first
+            __free_page(copy);
+        }
+        put_page(page);
+    }
+}
+
+// the first range in front of range that conflicts with it, NULL if there is none. Called under
+// range_lock.
+static struct mycdrv_range *mycdrv_range_blocker(asp_mycdev *dev, struct mycdrv_range *range)
+{
+    struct mycdrv_range *prev;
+
+    list_for_each_entry(prev, &dev->ranges, node)
+    {
+        if (prev == range)
+            break;
+        if (mycdrv_core_ranges_conflict(prev->start, prev->end, prev->write, range->start, range->end, range->write))
+            return prev;
+    }
+    return NULL;
+}
+
+// append the range to the list, holding it if nothing on the list conflicts with it. Waiting ranges
+// count too, so a waiting writer isn't overtaken by a stream of readers overlapping the held ones. A
+// range that doesn't get the lock is left on the list waiting if queue is set.
+static bool mycdrv_range_insert(asp_mycdev *dev, struct mycdrv_range *range, bool queue)
+{
+    bool held;
+
+    // checksums cover whole pages, so accesses to the same page exclude each other
+    if (dev->integrity)
+    {
+        range->start = round_down(range->start, PAGE_SIZE);
+        range->end = round_up(range->end, PAGE_SIZE);
+    }
+    spin_lock(&dev->range_lock);
+    held = !mycdrv_range_blocker(dev, range);
+    range->waiting = !held;
+    if (held || queue)
+        list_add_tail(&range->node, &dev->ranges);
+    spin_unlock(&dev->range_lock);
+    return held;
+}
+
+// insert the range if it doesn't conflict with a held or waiting one, overlapping reads may share.
+static bool mycdrv_range_trylock(asp_mycdev *dev, struct mycdrv_range *range)
+{
+    return mycdrv_range_insert(dev, range, false);
+}
+
+// hand the lock to the waiting ranges nothing in front of them conflicts with any more, so waiters are
+// served in order. Called under range_lock, returns whether any range got the lock.
+static bool mycdrv_range_grant(asp_mycdev *dev)
+{
+    struct mycdrv_range *range;
+    bool granted = false;
+
+    list_for_each_entry(range, &dev->ranges, node)
+    {
+        if (range->waiting && !mycdrv_range_blocker(dev, range))
+        {
+            // pairs with the acquire of the waiter, what the previous holders wrote is visible to it
+            smp_store_release(&range->waiting, false);
+            granted = true;
+        }
+    }
+    return granted;
+}
+
+static void mycdrv_range_unlock(asp_mycdev *dev, struct mycdrv_range *range)
+{
+    bool granted;
+
+    spin_lock(&dev->range_lock);
+    list_del(&range->node);
+    granted = mycdrv_range_grant(dev);
+    spin_unlock(&dev->range_lock);
+    // a waiter that didn't get the lock has nothing to recheck
+    if (granted)
+        wake_up_all(&dev->rangeq);
+}
+
+// lock the bytes [start, end) of the device, called with the device semaphore held shared. The caller
+// must not hold another range of the device, it could be waiting behind a range that waits for ours.
+static int mycdrv_range_lock(asp_mycdev *dev, struct mycdrv_range *range, loff_t start, loff_t end, bool write)
+{
+    range->start = start;
+    range->end = end;
+    range->write = write;
+    if (mycdrv_range_insert(dev, range, true))
+        return 0;
+    if (!wait_event_killable(dev->rangeq, !smp_load_acquire(&range->waiting)))
+        return 0;
+    // leave the queue, or give the lock back if it was granted meanwhile. The ranges behind us may go.
+    mycdrv_range_unlock(dev, range);
+    return -ERESTARTSYS;
+}
+
+// for the block queue, which may run in the submitter's context: a fatal signal must not fail the I/O.
+static void mycdrv_range_lock_uninterruptible(asp_mycdev *dev, struct mycdrv_range *range, loff_t start, loff_t end, bool write)
+{
+    range->start = start;
+    range->end = end;
+    range->write = write;
+    if (!mycdrv_range_insert(dev, range, true))
+        wait_event(dev->rangeq, !smp_load_acquire(&range->waiting));
+}
+
+// IOCB_NOWAIT variant, fails instead of waiting for an overlapping range.
+static int mycdrv_range_lock_nowait(asp_mycdev *dev, struct mycdrv_range *range, loff_t start, loff_t end, bool write)
+{
+    range->start = start;
+    range->end = end;
+    range->write = write;
+    return mycdrv_range_trylock(dev, range) ? 0 : -EAGAIN;
+}
+
+// extend the end of the written data, callable without holding the device semaphore.
+static void mycdrv_extend_buf_size(asp_mycdev *dev, loff_t end)
+{
+    spin_lock(&dev->size_lock);
+    if (end > dev->buf_size)
+        dev->buf_size = end;
+    spin_unlock(&dev->size_lock);
+}
+
+// copy lbuf bytes at pos out of the ramdisk into the iterator, holes are copied as zeros.
+static ssize_t mycdrv_copy_to_iter(asp_mycdev *dev, loff_t pos, size_t lbuf, struct iov_iter *to)
+{
+    size_t done = 0;
+    ssize_t err = -EFAULT;
+
+    while (done < lbuf)
+    {
+        size_t offset = offset_in_page(pos);
+        size_t chunk = mycdrv_core_chunk(pos, lbuf - done);
+        struct page *page = mycdrv_lookup_page(dev, pos >> PAGE_SHIFT);
+        size_t copied;
+
+        if (IS_ERR(page))
+        {
+            err = PTR_ERR(page);
+            break;
+        }
+        if (page && dev->integrity && !mycdrv_crc_verify(dev, pos >> PAGE_SHIFT, page, false))
+        {
+            err = -EIO;
+            break;
+        }
+        if (page)
+            copied = copy_page_to_iter(page, offset, chunk, to);
+        else
+            copied = iov_iter_zero(chunk, to);
+        done += copied;
+        pos += copied;
+        if (copied < chunk)
+            break;
+    }
+    return done ? done : (lbuf ? err : 0);
+}
+
+// copy lbuf bytes from the iterator into the ramdisk at pos, allocating the touched pages.
+static ssize_t mycdrv_copy_from_iter(asp_mycdev *dev, loff_t pos, size_t lbuf, struct iov_iter *from)
+{
+    size_t done = 0;
+    int err = 0;
+
+    while (done < lbuf)
+    {
+        size_t offset = offset_in_page(pos);
+        size_t chunk = mycdrv_core_chunk(pos, lbuf - done);
+        struct page *page = mycdrv_get_page_write(dev, pos >> PAGE_SHIFT);
+        size_t copied;
+
+        if (!page)
+        {
+            err = -ENOMEM;
+            break;
+        }
+        copied = copy_page_from_iter(page, offset, chunk, from);
+        flush_dcache_page(page);
+        mycdrv_crc_update(dev, pos >> PAGE_SHIFT, page);
+        done += copied;
+        pos += copied;
+        if (copied < chunk)
+        {
+            err = -EFAULT;
+            break;
+        }
+    }
+    return done ? done : err;
+}
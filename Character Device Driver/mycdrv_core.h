@@ -0,0 +1,78 @@
+//Author - Venkata Sai Gireesh Chamarthi
+// storage and seek logic of the mycdrv random-access devices that doesn't depend on the kernel, shared by
+// char_driver.c and the user space build in mycdrv_user.c. Only arithmetic on positions and sizes lives
+// here, the callers hold the device locks. The page store and the range locks are in mycdrv_core.c.
+#ifndef MYCDRV_CORE_H
+#define MYCDRV_CORE_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#include <linux/errno.h>
+#include <linux/fs.h>
+#include <linux/mm.h>
+#else
+#include "mycdrv_shim.h"
+#endif
+
+// a read or write of lbuf bytes at pos is done whole or not at all, one running past ram_size
+// transfers nothing
+static inline bool mycdrv_core_rw_fits(loff_t pos, size_t lbuf, size_t ram_size)
+{
+    return lbuf && pos >= 0 && (lbuf + pos) <= ram_size;
+}
+
+// bytes of a copy of left bytes at pos that fall into the page holding pos
+static inline size_t mycdrv_core_chunk(loff_t pos, size_t left)
+{
+    size_t offset = pos & (PAGE_SIZE - 1);
+
+    return left < PAGE_SIZE - offset ? left : PAGE_SIZE - offset;
+}
+
+// two locked byte ranges [start, end) exclude each other if they overlap and one of them writes
+static inline bool mycdrv_core_ranges_conflict(loff_t start1, loff_t end1, bool write1,
+                                               loff_t start2, loff_t end2, bool write2)
+{
+    return start1 < end2 && start2 < end1 && (write1 || write2);
+}
+
+// the position lseek asks for, before the device grows and the result is clamped. SEEK_END is the
+// end of the written data, not of the device.
+static inline int mycdrv_core_seek_pos(loff_t f_pos, loff_t offset, int whence, loff_t buf_size, loff_t *pos)
+{
+    switch (whence)
+    {
+    case SEEK_SET:
+        *pos = offset;
+        break;
+    case SEEK_CUR:
+        *pos = f_pos + offset;
+        break;
+    case SEEK_END:
+        *pos = buf_size + offset;
+        break;
+    default:
+        return -EINVAL;
+    }
+    return 0;
+}
+
+// true if seeking to pos grows the device
+static inline bool mycdrv_core_seek_grows(loff_t pos, size_t ram_size)
+{
+    return pos > (loff_t)ram_size;
+}
+
+// the size after seeking past the end: one growth step, whatever the distance. The new space is a hole.
+static inline size_t mycdrv_core_grow(size_t ram_size, size_t step)
+{
+    return ram_size + step;
+}
+
+// the file position lseek settles on, a position before the start becomes 0
+static inline loff_t mycdrv_core_seek_clamp(loff_t pos)
+{
+    return pos >= 0 ? pos : 0;
+}
+
+#endif
@@ -0,0 +1,181 @@
+//Author - Venkata Sai Gireesh Chamarthi
+// libFuzzer target for the user space build of the mycdrv core. The input is a sequence of reads, writes,
+// seeks and clears that runs against a device and against a flat buffer model of the driver's documented
+// semantics, any difference aborts. Built with -DMYCDRV_FUZZ_MAIN it replays input files without libFuzzer.
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mycdrv_user.h"
+
+#define FUZZ_PAGE 4096
+
+struct model {
+	unsigned char *data;
+	size_t ram_size;
+	loff_t buf_size;
+	loff_t f_pos;
+};
+
+struct input {
+	const uint8_t *data;
+	size_t size;
+};
+
+// little endian value of the next bytes, missing bytes read as zero
+static uint64_t take(struct input *in, int bytes)
+{
+	uint64_t v = 0;
+	int i;
+
+	for (i = 0; i < bytes && in->size; i++, in->data++, in->size--)
+		v |= (uint64_t)*in->data << (8 * i);
+	return v;
+}
+
+static void check(int ok, const char *what)
+{
+	if (!ok) {
+		fprintf(stderr, "mycdrv_fuzz: %s differs from the model\n", what);
+		abort();
+	}
+}
+
+// a read or write that runs past the end of the device transfers nothing
+static int model_fits(const struct model *m, loff_t pos, size_t len)
+{
+	return len && pos >= 0 && (uint64_t)pos + len <= m->ram_size;
+}
+
+static loff_t model_seek(struct model *m, loff_t offset, int whence)
+{
+	loff_t pos;
+
+	if (whence == SEEK_SET)
+		pos = offset;
+	else if (whence == SEEK_CUR)
+		pos = m->f_pos + offset;
+	else if (whence == SEEK_END)
+		pos = m->buf_size + offset;
+	else
+		return -EINVAL;
+	// seeking past the end grows the device by a page, however far it goes
+	if (pos > (loff_t)m->ram_size) {
+		m->data = realloc(m->data, m->ram_size + FUZZ_PAGE);
+		if (!m->data)
+			abort();
+		memset(m->data + m->ram_size, 0, FUZZ_PAGE);
+		m->ram_size += FUZZ_PAGE;
+	}
+	m->f_pos = pos >= 0 ? pos : 0;
+	return m->f_pos;
+}
+
+static void run(const uint8_t *data, size_t size)
+{
+	struct input in = { data, size };
+	struct mycdrv_user_dev *dev;
+	struct model m = {};
+	unsigned char *buf, *want;
+	loff_t f_pos = 0, pos;
+	ssize_t ret, expect;
+	size_t len;
+	int op;
+
+	dev = mycdrv_user_create(0);
+	m.ram_size = mycdrv_user_ram_size(dev);
+	m.data = calloc(1, m.ram_size);
+	buf = malloc(2 * FUZZ_PAGE);
+	want = malloc(2 * FUZZ_PAGE);
+	if (!m.data || !buf || !want)
+		abort();
+
+	while (in.size) {
+		op = (int)(take(&in, 1) % 5);
+		switch (op) {
+		case 0: // write at the file position
+			len = take(&in, 2) % (2 * FUZZ_PAGE);
+			memset(buf, (int)take(&in, 1), len);
+			ret = mycdrv_user_write(dev, buf, len, &f_pos);
+			expect = model_fits(&m, m.f_pos, len) ? (ssize_t)len : 0;
+			if (expect) {
+				memcpy(m.data + m.f_pos, buf, len);
+				m.f_pos += len;
+				if (m.f_pos > m.buf_size)
+					m.buf_size = m.f_pos;
+			}
+			check(ret == expect, "write result");
+			break;
+		case 1: // read at the file position
+		case 2: // read at a random position, like pread
+			len = take(&in, 2) % (2 * FUZZ_PAGE);
+			pos = f_pos;
+			if (op == 2)
+				pos = m.f_pos = f_pos = take(&in, 4) % (m.ram_size + 2 * FUZZ_PAGE);
+			ret = mycdrv_user_read(dev, buf, len, &f_pos);
+			expect = model_fits(&m, pos, len) ? (ssize_t)len : 0;
+			if (expect) {
+				memcpy(want, m.data + pos, len);
+				m.f_pos += len;
+			}
+			check(ret == expect, "read result");
+			check(!expect || !memcmp(buf, want, len), "read data");
+			break;
+		case 3: // lseek, whence 3 is invalid
+			{
+				loff_t offset = (int32_t)take(&in, 4) % (loff_t)(2 * m.ram_size);
+				int whence = (int)(take(&in, 1) % 4);
+
+				ret = mycdrv_user_llseek(dev, &f_pos, offset, whence);
+				check(ret == model_seek(&m, offset, whence), "lseek result");
+			}
+			break;
+		case 4: // ASP_CLEAR_BUF
+			mycdrv_user_clear(dev, &f_pos);
+			memset(m.data, 0, m.ram_size);
+			m.buf_size = 0;
+			m.f_pos = 0;
+			break;
+		}
+		check(f_pos == m.f_pos, "file position");
+		check(mycdrv_user_ram_size(dev) == m.ram_size, "device size");
+		check(mycdrv_user_buf_size(dev) == m.buf_size, "written size");
+	}
+
+	free(want);
+	free(buf);
+	free(m.data);
+	mycdrv_user_destroy(dev);
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	run(data, size);
+	return 0;
+}
+
+#ifdef MYCDRV_FUZZ_MAIN
+int main(int argc, char *argv[])
+{
+	static uint8_t data[1 << 20];
+	size_t size;
+	FILE *f;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		f = fopen(argv[i], "rb");
+		if (!f) {
+			perror(argv[i]);
+			return 1;
+		}
+		size = fread(data, 1, sizeof(data), f);
+		fclose(f);
+		run(data, size);
+	}
+	return 0;
+}
+#endif
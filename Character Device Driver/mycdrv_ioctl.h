@@ -0,0 +1,140 @@
+//Author - Venkata Sai Gireesh Chamarthi
+// ioctl interface of the mycdrv character driver, shared by char_driver.c and the user space programs.
+#ifndef MYCDRV_IOCTL_H
+#define MYCDRV_IOCTL_H
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+#define CDRV_IOC_MAGIC 'Z'
+#define ASP_CLEAR_BUF _IOW(CDRV_IOC_MAGIC, 1, int)
+#define ASP_IO_BATCH _IOWR(CDRV_IOC_MAGIC, 2, struct mycdrv_io_batch)
+#define ASP_SET_MODE _IOW(CDRV_IOC_MAGIC, 3, int) // argument is the MYCDRV_MODE_* value, contents are dropped
+#define ASP_RING_WAIT _IO(CDRV_IOC_MAGIC, 4) // ring consumer: sleep until the producer index moves past the consumer index
+#define ASP_RING_KICK _IO(CDRV_IOC_MAGIC, 5) // ring producer: wake the consumer sleeping in ASP_RING_WAIT or poll
+#define ASP_ZERO_RANGE _IOW(CDRV_IOC_MAGIC, 6, struct mycdrv_range_op) // zero a range, present pages stay allocated
+#define ASP_PUNCH_HOLE _IOW(CDRV_IOC_MAGIC, 7, struct mycdrv_range_op) // zero a range, whole pages are released
+#define ASP_COPY_RANGE _IOW(CDRV_IOC_MAGIC, 8, struct mycdrv_copy_range) // copy into this device, returns the bytes copied
+#define ASP_PERSIST _IOW(CDRV_IOC_MAGIC, 12, struct mycdrv_persist) // write the device to a file, returns the bytes of data
+#define ASP_RESTORE _IOW(CDRV_IOC_MAGIC, 13, struct mycdrv_persist) // replace the contents from such a file
+#define ASP_SCRUB _IO(CDRV_IOC_MAGIC, 14) // verify the page checksums of a MYCDRV_DEV_CRC device, returns the mismatches
+
+// ioctls of the control node /dev/mycdrv-control, they need CAP_SYS_ADMIN
+#define ASP_DEV_ADD _IOWR(CDRV_IOC_MAGIC, 9, struct mycdrv_dev_spec)
+#define ASP_DEV_REMOVE _IOW(CDRV_IOC_MAGIC, 10, int) // argument is the device number, open files keep working until closed
+#define ASP_DEV_SNAPSHOT _IOWR(CDRV_IOC_MAGIC, 11, struct mycdrv_snapshot_spec)
+
+// device numbers run from 0 to MYCDRV_MAX_DEVICES - 1, /dev/mycdrv<n>
+#define MYCDRV_MAX_DEVICES 255
+#define MYCDRV_DEV_ANY 0xffffffffu // let ASP_DEV_ADD pick the lowest free device number
+
+// flags of struct mycdrv_dev_spec
+#define MYCDRV_DEV_BLKDEV 1 // also create the block device /dev/mycdrvb<n> over the same ramdisk
+#define MYCDRV_DEV_HUGE 2   // allocate pages in 2 MiB runs, the size is rounded up to and grows by whole runs
+#define MYCDRV_DEV_CRC 4    // keep a crc32c of every page, reads of a page that doesn't match fail with EIO
+
+// NUMA placement of a device's pages, otherwise a node id
+#define MYCDRV_NODE_LOCAL (-1)      // node of the cpu that allocates the page
+#define MYCDRV_NODE_INTERLEAVE (-2) // round robin over the online nodes by page index
+
+// device modes
+#define MYCDRV_MODE_RANDOM 0 // random-access ramdisk, the default
+#define MYCDRV_MODE_FIFO 1   // bounded stream buffer, readers block for data and writers for space
+#define MYCDRV_MODE_RING 2   // single producer single consumer ring shared through mmap, needs a power of two size
+#define MYCDRV_MODE_LOG 3    // append-only log: every O_APPEND write appends one whole record, reads end at the last complete one
+
+// operations of a batch descriptor
+#define MYCDRV_OP_READ 0
+#define MYCDRV_OP_WRITE 1
+
+// largest number of descriptors accepted by one ASP_IO_BATCH call
+#define MYCDRV_BATCH_MAX 1024
+
+// one read or write of len bytes at offset of the random-access device open as fd, from or into buf.
+// The file must be open for reading or writing like for pread and pwrite, or the entry fails with EBADF.
+struct mycdrv_io_desc
+{
+    __s32 fd;
+    __u32 op;
+    __u64 offset;
+    __u64 len;
+    __u64 buf;    // user space address of the data
+    __s64 result; // filled in by the driver: bytes transferred or a negative errno
+};
+
+// ASP_IO_BATCH argument, the ioctl returns the number of descriptors executed.
+struct mycdrv_io_batch
+{
+    __u64 descs; // user space address of an array of struct mycdrv_io_desc
+    __u32 count;
+    __u32 flags; // must be 0
+};
+
+// ASP_ZERO_RANGE and ASP_PUNCH_HOLE argument, the range must lie within the device.
+struct mycdrv_range_op
+{
+    __u64 offset;
+    __u64 len;
+};
+
+// ASP_COPY_RANGE argument: copy len bytes at src_offset of the random-access device open for reading
+// as src_fd to dst_offset of the device the ioctl is issued on, which must be open for writing.
+// Overlapping ranges of the same device are rejected.
+struct mycdrv_copy_range
+{
+    __u64 src_offset;
+    __u64 dst_offset;
+    __u64 len;
+    __s32 src_fd;
+    __u32 flags; // must be 0
+};
+
+// ASP_PERSIST and ASP_RESTORE argument. The image is a sparse regular file holding the device's bytes at
+// their own offsets, its size is the end of the device's data.
+struct mycdrv_persist
+{
+    __s32 fd;    // the file, open for writing to persist and for reading to restore
+    __u32 flags; // must be 0
+};
+
+// ASP_DEV_ADD argument
+struct mycdrv_dev_spec
+{
+    __u32 dev;               // device number or MYCDRV_DEV_ANY, set to the number created
+    __u32 mode;              // MYCDRV_MODE_*, ring mode needs a power of two size
+    __u64 size;              // capacity in bytes rounded up to pages, 0 for the default of 16 pages
+    __s32 numa_node;         // node id, MYCDRV_NODE_LOCAL or MYCDRV_NODE_INTERLEAVE
+    __u32 compress_interval; // seconds untouched before a page is compressed, 0 disables
+    __u32 flags;             // MYCDRV_DEV_*
+    __u32 pad;               // must be 0
+};
+
+// ASP_DEV_SNAPSHOT argument: create a read-only device holding the current contents of a random-access
+// device. Pages are shared copy-on-write, removing either device leaves the other intact.
+struct mycdrv_snapshot_spec
+{
+    __u32 src_dev; // device to take the snapshot of
+    __u32 dev;     // device number or MYCDRV_DEV_ANY, set to the number created
+    __u32 flags;   // must be 0
+    __u32 pad;     // must be 0
+};
+
+// Control page of a ring mode device, mapped at mmap offset 0. The ring data follows at an offset
+// of one page. producer and consumer are free running byte counters, a byte lives at
+// index & (ring_size - 1) and the ring holds producer - consumer bytes.
+//
+// Producer: write the data, store-release producer, full barrier, then ASP_RING_KICK if consumer_waiting is set.
+// Consumer: load-acquire producer, read the data, store-release consumer. When the ring is empty
+// ASP_RING_WAIT (or poll for POLLIN) sets consumer_waiting and sleeps until the producer kicks.
+struct mycdrv_ring_ctrl
+{
+    __u64 producer; // written only by the producer
+    __u8 pad0[56];  // keep the indices on separate cachelines
+    __u64 consumer; // written only by the consumer
+    __u8 pad1[56];
+    __u32 consumer_waiting; // set by the driver while the consumer sleeps
+    __u32 pad2;
+    __u64 ring_size; // bytes of ring data, set by the driver
+};
+
+#endif
@@ -0,0 +1,365 @@
+//Author - Venkata Sai Gireesh Chamarthi
+// KUnit tests and microbenchmarks of the mycdrv data path. This file is included at the end of
+// char_driver.c when it is built with make KUNIT=1, so the tests call the static functions directly.
+#include <kunit/test.h>
+
+#define MYCDRV_TEST_PATTERN "mycdrv kunit"
+#define MYCDRV_BENCH_LOOPS 10000
+
+// every test gets a fresh random-access device of the default size and a file opened on it
+struct mycdrv_test
+{
+    asp_mycdev *dev;
+    struct file *file;
+};
+
+static int mycdrv_test_init(struct kunit *test)
+{
+    struct mycdrv_dev_spec spec = {
+        .dev = MYCDRV_DEV_ANY,
+        .mode = MYCDRV_MODE_RANDOM,
+        .numa_node = NUMA_NO_NODE,
+    };
+    struct mycdrv_test *t;
+
+    t = kunit_kzalloc(test, sizeof(*t), GFP_KERNEL);
+    if (!t)
+        return -ENOMEM;
+    t->file = kunit_kzalloc(test, sizeof(*t->file), GFP_KERNEL);
+    if (!t->file)
+        return -ENOMEM;
+    mutex_lock(&mycdrv_devices_lock);
+    t->dev = mycdrv_create_dev(&spec, NULL);
+    mutex_unlock(&mycdrv_devices_lock);
+    if (IS_ERR(t->dev))
+        return PTR_ERR(t->dev);
+    t->file->private_data = t->dev;
+    t->file->f_mode = FMODE_READ | FMODE_WRITE;
+    test->priv = t;
+    return 0;
+}
+
+static void mycdrv_test_exit(struct kunit *test)
+{
+    struct mycdrv_test *t = test->priv;
+
+    // init failed before the device was created
+    if (!t || IS_ERR_OR_NULL(t->dev))
+        return;
+    mutex_lock(&mycdrv_devices_lock);
+    mycdrv_remove_dev(t->dev);
+    mutex_unlock(&mycdrv_devices_lock);
+}
+
+static ssize_t mycdrv_test_write(asp_mycdev *dev, loff_t *pos, const void *buf, size_t len)
+{
+    struct kvec kv = { .iov_base = (void *)buf, .iov_len = len };
+    struct iov_iter iter;
+
+    iov_iter_kvec(&iter, WRITE, &kv, 1, len);
+    return mycdrv_do_write(dev, pos, &iter, false);
+}
+
+static ssize_t mycdrv_test_read(asp_mycdev *dev, loff_t *pos, void *buf, size_t len)
+{
+    struct kvec kv = { .iov_base = buf, .iov_len = len };
+    struct iov_iter iter;
+
+    iov_iter_kvec(&iter, READ, &kv, 1, len);
+    return mycdrv_do_read(dev, pos, &iter, false);
+}
+
+static void mycdrv_test_read_write(struct kunit *test)
+{
+    struct mycdrv_test *t = test->priv;
+    char buf[sizeof(MYCDRV_TEST_PATTERN)];
+    loff_t pos = PAGE_SIZE - 4;
+
+    // straddles a page boundary
+    KUNIT_EXPECT_EQ(test, mycdrv_test_write(t->dev, &pos, MYCDRV_TEST_PATTERN, sizeof(buf)), (ssize_t)sizeof(buf));
+    KUNIT_EXPECT_EQ(test, pos, (loff_t)(PAGE_SIZE - 4 + sizeof(buf)));
+    KUNIT_EXPECT_EQ(test, t->dev->buf_size, pos);
+
+    pos = PAGE_SIZE - 4;
+    KUNIT_EXPECT_EQ(test, mycdrv_test_read(t->dev, &pos, buf, sizeof(buf)), (ssize_t)sizeof(buf));
+    KUNIT_EXPECT_STREQ(test, buf, MYCDRV_TEST_PATTERN);
+}
+
+static void mycdrv_test_holes(struct kunit *test)
+{
+    struct mycdrv_test *t = test->priv;
+    char buf[64];
+    loff_t pos = 3 * PAGE_SIZE;
+
+    // reading a hole gives zeros and allocates nothing
+    memset(buf, 0xff, sizeof(buf));
+    KUNIT_EXPECT_EQ(test, mycdrv_test_read(t->dev, &pos, buf, sizeof(buf)), (ssize_t)sizeof(buf));
+    KUNIT_EXPECT_EQ(test, memchr_inv(buf, 0, sizeof(buf)), NULL);
+    KUNIT_EXPECT_TRUE(test, xa_empty(&t->dev->pages));
+    KUNIT_EXPECT_EQ(test, t->dev->buf_size, (loff_t)0);
+}
+
+static void mycdrv_test_end_of_device(struct kunit *test)
+{
+    struct mycdrv_test *t = test->priv;
+    size_t ram_size = t->dev->ram_size;
+    char buf[8] = "abcdefg";
+    loff_t pos;
+
+    // an access running past the end transfers nothing, not even the part that fits
+    pos = ram_size - 4;
+    KUNIT_EXPECT_EQ(test, mycdrv_test_write(t->dev, &pos, buf, sizeof(buf)), (ssize_t)0);
+    KUNIT_EXPECT_EQ(test, pos, (loff_t)(ram_size - 4));
+    KUNIT_EXPECT_TRUE(test, xa_empty(&t->dev->pages));
+    KUNIT_EXPECT_EQ(test, mycdrv_test_read(t->dev, &pos, buf, sizeof(buf)), (ssize_t)0);
+
+    // one that ends exactly at the end is complete
+    KUNIT_EXPECT_EQ(test, mycdrv_test_write(t->dev, &pos, buf, 4), (ssize_t)4);
+    KUNIT_EXPECT_EQ(test, pos, (loff_t)ram_size);
+    KUNIT_EXPECT_EQ(test, t->dev->buf_size, (loff_t)ram_size);
+    pos = ram_size - 4;
+    KUNIT_EXPECT_EQ(test, mycdrv_test_read(t->dev, &pos, buf, 4), (ssize_t)4);
+
+    // empty transfers and transfers at the end return 0
+    KUNIT_EXPECT_EQ(test, mycdrv_test_write(t->dev, &pos, buf, 0), (ssize_t)0);
+    KUNIT_EXPECT_EQ(test, mycdrv_test_read(t->dev, &pos, buf, 1), (ssize_t)0);
+}
+
+static void mycdrv_test_seek_end(struct kunit *test)
+{
+    struct mycdrv_test *t = test->priv;
+    size_t ram_size = t->dev->ram_size;
+    char buf[100] = {};
+    loff_t pos = 0;
+
+    // SEEK_END is the end of the written data, not of the device
+    KUNIT_EXPECT_EQ(test, mycdrv_llseek(t->file, 0, SEEK_END), (loff_t)0);
+    KUNIT_EXPECT_EQ(test, mycdrv_test_write(t->dev, &pos, buf, sizeof(buf)), (ssize_t)sizeof(buf));
+    KUNIT_EXPECT_EQ(test, mycdrv_llseek(t->file, 0, SEEK_END), (loff_t)sizeof(buf));
+    KUNIT_EXPECT_EQ(test, mycdrv_llseek(t->file, -10, SEEK_END), (loff_t)sizeof(buf) - 10);
+    KUNIT_EXPECT_EQ(test, t->file->f_pos, (loff_t)sizeof(buf) - 10);
+    KUNIT_EXPECT_EQ(test, mycdrv_llseek(t->file, 5, SEEK_CUR), (loff_t)sizeof(buf) - 5);
+
+    // a position before the start is clamped to 0 and doesn't grow the device
+    KUNIT_EXPECT_EQ(test, mycdrv_llseek(t->file, -1000, SEEK_END), (loff_t)0);
+    KUNIT_EXPECT_EQ(test, t->dev->ram_size, ram_size);
+    KUNIT_EXPECT_EQ(test, mycdrv_llseek(t->file, 0, 42), (loff_t)-EINVAL);
+}
+
+static void mycdrv_test_seek_grow(struct kunit *test)
+{
+    struct mycdrv_test *t = test->priv;
+    size_t ram_size = t->dev->ram_size;
+
+    // seeking up to the end doesn't grow the device
+    KUNIT_EXPECT_EQ(test, mycdrv_llseek(t->file, ram_size, SEEK_SET), (loff_t)ram_size);
+    KUNIT_EXPECT_EQ(test, t->dev->ram_size, ram_size);
+
+    // seeking past it grows by one step, which only extends the size
+    KUNIT_EXPECT_EQ(test, mycdrv_llseek(t->file, ram_size + 1, SEEK_SET), (loff_t)ram_size + 1);
+    KUNIT_EXPECT_EQ(test, t->dev->ram_size, ram_size + mycdrv_grow_step(t->dev));
+    KUNIT_EXPECT_TRUE(test, xa_empty(&t->dev->pages));
+
+    // also when the new position is further away than one step
+    ram_size = t->dev->ram_size;
+    KUNIT_EXPECT_EQ(test, mycdrv_llseek(t->file, 2 * PAGE_SIZE, SEEK_END), (loff_t)2 * PAGE_SIZE);
+    KUNIT_EXPECT_EQ(test, t->dev->ram_size, ram_size);
+    KUNIT_EXPECT_EQ(test, mycdrv_llseek(t->file, ram_size + 3 * PAGE_SIZE, SEEK_SET), (loff_t)ram_size + 3 * PAGE_SIZE);
+    KUNIT_EXPECT_EQ(test, t->dev->ram_size, ram_size + mycdrv_grow_step(t->dev));
+}
+
+static void mycdrv_test_clear(struct kunit *test)
+{
+    struct mycdrv_test *t = test->priv;
+    char buf[sizeof(MYCDRV_TEST_PATTERN)];
+    loff_t pos = PAGE_SIZE;
+
+    KUNIT_ASSERT_EQ(test, mycdrv_test_write(t->dev, &pos, MYCDRV_TEST_PATTERN, sizeof(buf)), (ssize_t)sizeof(buf));
+    t->file->f_pos = pos;
+
+    // a file open only for reading can't clear the device
+    t->file->f_mode = FMODE_READ;
+    KUNIT_EXPECT_EQ(test, mycdrv_ioctl(t->file, ASP_CLEAR_BUF, 0), (long)-EBADF);
+    KUNIT_EXPECT_EQ(test, t->dev->buf_size, pos);
+    t->file->f_mode = FMODE_READ | FMODE_WRITE;
+
+    // ASP_CLEAR_BUF frees the pages and rewinds the file and the written size
+    KUNIT_EXPECT_EQ(test, mycdrv_ioctl(t->file, ASP_CLEAR_BUF, 0), 0L);
+    KUNIT_EXPECT_EQ(test, t->file->f_pos, (loff_t)0);
+    KUNIT_EXPECT_EQ(test, t->dev->buf_size, (loff_t)0);
+    KUNIT_EXPECT_TRUE(test, xa_empty(&t->dev->pages));
+    KUNIT_EXPECT_EQ(test, mycdrv_llseek(t->file, 0, SEEK_END), (loff_t)0);
+
+    pos = PAGE_SIZE;
+    KUNIT_EXPECT_EQ(test, mycdrv_test_read(t->dev, &pos, buf, sizeof(buf)), (ssize_t)sizeof(buf));
+    KUNIT_EXPECT_EQ(test, memchr_inv(buf, 0, sizeof(buf)), NULL);
+}
+
+static void mycdrv_test_integrity(struct kunit *test)
+{
+    struct mycdrv_test *t = test->priv;
+    char buf[sizeof(MYCDRV_TEST_PATTERN)];
+    struct page *page;
+    loff_t pos = 0;
+    u8 *addr;
+
+    // the device is still empty, so it can start keeping checksums
+    t->dev->integrity = true;
+    KUNIT_ASSERT_EQ(test, mycdrv_test_write(t->dev, &pos, MYCDRV_TEST_PATTERN, sizeof(buf)), (ssize_t)sizeof(buf));
+    KUNIT_EXPECT_TRUE(test, xa_load(&t->dev->crcs, 0) != NULL);
+    KUNIT_EXPECT_EQ(test, mycdrv_scrub(t->dev), 0L);
+
+    KUNIT_EXPECT_TRUE(test, xa_get_mark(&t->dev->crcs, 0, MYCDRV_CRC_VERIFIED));
+
+    // flip a bit behind the driver's back. A verified page isn't checked by reads again, the scrub
+    // catches it and reads fail from then on.
+    page = xa_load(&t->dev->pages, 0);
+    KUNIT_ASSERT_NOT_ERR_OR_NULL(test, page);
+    addr = kmap_local_page(page);
+    addr[100] ^= 1;
+    kunmap_local(addr);
+    KUNIT_EXPECT_EQ(test, mycdrv_scrub(t->dev), 1L);
+    KUNIT_EXPECT_FALSE(test, xa_get_mark(&t->dev->crcs, 0, MYCDRV_CRC_VERIFIED));
+    pos = 0;
+    KUNIT_EXPECT_EQ(test, mycdrv_test_read(t->dev, &pos, buf, sizeof(buf)), (ssize_t)-EIO);
+
+    // rewriting any part of the page takes its current contents as good again, the next read verifies it
+    pos = 0;
+    KUNIT_ASSERT_EQ(test, mycdrv_test_write(t->dev, &pos, MYCDRV_TEST_PATTERN, sizeof(buf)), (ssize_t)sizeof(buf));
+    KUNIT_EXPECT_FALSE(test, xa_get_mark(&t->dev->crcs, 0, MYCDRV_CRC_VERIFIED));
+    pos = 0;
+    KUNIT_EXPECT_EQ(test, mycdrv_test_read(t->dev, &pos, buf, sizeof(buf)), (ssize_t)sizeof(buf));
+    KUNIT_EXPECT_EQ(test, mycdrv_scrub(t->dev), 0L);
+
+    // freed pages lose their checksums
+    KUNIT_EXPECT_EQ(test, mycdrv_do_zero_range(t->dev, 0, PAGE_SIZE, true, true), 0L);
+    KUNIT_EXPECT_TRUE(test, xa_load(&t->dev->crcs, 0) == NULL);
+}
+
+// a writer queued behind a reader isn't overtaken by later readers, and gets the lock when the reader goes
+static void mycdrv_test_range_order(struct kunit *test)
+{
+    struct mycdrv_test *t = test->priv;
+    struct mycdrv_range reader, writer, late;
+
+    down_read(&t->dev->sem);
+    KUNIT_ASSERT_EQ(test, mycdrv_range_lock(t->dev, &reader, 0, PAGE_SIZE, false), 0);
+    writer.start = 0;
+    writer.end = PAGE_SIZE;
+    writer.write = true;
+    KUNIT_EXPECT_FALSE(test, mycdrv_range_insert(t->dev, &writer, true));
+
+    late.start = 0;
+    late.end = PAGE_SIZE;
+    late.write = false;
+    KUNIT_EXPECT_FALSE(test, mycdrv_range_trylock(t->dev, &late));
+    // ranges that don't overlap the waiting one aren't held up
+    late.start = PAGE_SIZE;
+    late.end = 2 * PAGE_SIZE;
+    late.write = true;
+    KUNIT_EXPECT_TRUE(test, mycdrv_range_trylock(t->dev, &late));
+    mycdrv_range_unlock(t->dev, &late);
+
+    mycdrv_range_unlock(t->dev, &reader);
+    KUNIT_EXPECT_FALSE(test, smp_load_acquire(&writer.waiting));
+    mycdrv_range_unlock(t->dev, &writer);
+    up_read(&t->dev->sem);
+}
+
+// time MYCDRV_BENCH_LOOPS page sized writes and reads spread over the device. The first pass over a page
+// allocates it, the device is small enough for that to vanish in the average.
+static void mycdrv_bench_copy(struct kunit *test)
+{
+    struct mycdrv_test *t = test->priv;
+    unsigned long pages = t->dev->ram_size >> PAGE_SHIFT;
+    u64 start, wr, rd;
+    loff_t pos;
+    void *buf;
+    int i;
+
+    buf = kunit_kzalloc(test, PAGE_SIZE, GFP_KERNEL);
+    KUNIT_ASSERT_NOT_ERR_OR_NULL(test, buf);
+
+    start = ktime_get_ns();
+    for (i = 0; i < MYCDRV_BENCH_LOOPS; i++)
+    {
+        pos = (loff_t)(i % pages) << PAGE_SHIFT;
+        KUNIT_ASSERT_EQ(test, mycdrv_test_write(t->dev, &pos, buf, PAGE_SIZE), (ssize_t)PAGE_SIZE);
+    }
+    wr = ktime_get_ns() - start;
+
+    start = ktime_get_ns();
+    for (i = 0; i < MYCDRV_BENCH_LOOPS; i++)
+    {
+        pos = (loff_t)(i % pages) << PAGE_SHIFT;
+        KUNIT_ASSERT_EQ(test, mycdrv_test_read(t->dev, &pos, buf, PAGE_SIZE), (ssize_t)PAGE_SIZE);
+    }
+    rd = ktime_get_ns() - start;
+
+    kunit_info(test, "%lu byte write %llu ns/op, read %llu ns/op\n", PAGE_SIZE,
+               div_u64(wr, MYCDRV_BENCH_LOOPS), div_u64(rd, MYCDRV_BENCH_LOOPS));
+}
+
+// time the uncontended locking every read and write goes through
+static void mycdrv_bench_lock(struct kunit *test)
+{
+    struct mycdrv_test *t = test->priv;
+    struct mycdrv_range range;
+    u64 start, sem, rng;
+    int i;
+
+    start = ktime_get_ns();
+    for (i = 0; i < MYCDRV_BENCH_LOOPS; i++)
+    {
+        down_read(&t->dev->sem);
+        up_read(&t->dev->sem);
+    }
+    sem = ktime_get_ns() - start;
+
+    down_read(&t->dev->sem);
+    start = ktime_get_ns();
+    for (i = 0; i < MYCDRV_BENCH_LOOPS; i++)
+    {
+        KUNIT_ASSERT_EQ(test, mycdrv_range_lock(t->dev, &range, 0, PAGE_SIZE, true), 0);
+        mycdrv_range_unlock(t->dev, &range);
+    }
+    rng = ktime_get_ns() - start;
+    up_read(&t->dev->sem);
+
+    kunit_info(test, "device semaphore %llu ns/op, range lock %llu ns/op\n",
+               div_u64(sem, MYCDRV_BENCH_LOOPS), div_u64(rng, MYCDRV_BENCH_LOOPS));
+}
+
+static struct kunit_case mycdrv_test_cases[] = {
+    KUNIT_CASE(mycdrv_test_read_write),
+    KUNIT_CASE(mycdrv_test_holes),
+    KUNIT_CASE(mycdrv_test_end_of_device),
+    KUNIT_CASE(mycdrv_test_seek_end),
+    KUNIT_CASE(mycdrv_test_seek_grow),
+    KUNIT_CASE(mycdrv_test_clear),
+    KUNIT_CASE(mycdrv_test_integrity),
+    KUNIT_CASE(mycdrv_test_range_order),
+    KUNIT_CASE(mycdrv_bench_copy),
+    KUNIT_CASE(mycdrv_bench_lock),
+    {}
+};
+
+static struct kunit_suite mycdrv_test_suite = {
+    .name = "mycdrv",
+    .init = mycdrv_test_init,
+    .exit = mycdrv_test_exit,
+    .test_cases = mycdrv_test_cases,
+};
+
+// kunit_test_suites() brings its own module_init, the driver runs the suite once its devices exist
+static struct kunit_suite *mycdrv_test_suites[] = { &mycdrv_test_suite, NULL };
+
+static void mycdrv_kunit_init(void)
+{
+    __kunit_test_suites_init(mycdrv_test_suites);
+}
+
+static void mycdrv_kunit_exit(void)
+{
+    __kunit_test_suites_exit(mycdrv_test_suites);
+}
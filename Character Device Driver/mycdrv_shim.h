@@ -0,0 +1,420 @@
+//Author - Venkata Sai Gireesh Chamarthi
+// the kernel types and functions mycdrv_core.h and mycdrv_core.c need, for the user space build. Pages are
+// malloc'd buffers with a reference count, the xarray a two level table with lock free loads, spinlocks
+// pthread mutexes and wait queues condition variables. Only what the core uses is provided, with the
+// semantics the core relies on.
+#ifndef MYCDRV_SHIM_H
+#define MYCDRV_SHIM_H
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h> // loff_t
+#include <unistd.h>    // SEEK_*
+
+// the driver works in pages of the kernel's size, 4 KiB on the platforms we run on
+#define PAGE_SHIFT 12
+#define PAGE_SIZE (1UL << PAGE_SHIFT)
+
+typedef unsigned long pgoff_t;
+typedef unsigned int gfp_t;
+
+#define READ_ONCE(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define smp_mb() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define smp_load_acquire(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define smp_store_release(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define min_t(type, a, b) ((type)(a) < (type)(b) ? (type)(a) : (type)(b))
+#define round_down(x, y) ((x) & ~((__typeof__(x))(y) - 1))
+#define round_up(x, y) ((((x) - 1) | ((__typeof__(x))(y) - 1)) + 1)
+#define offset_in_page(p) ((unsigned long)(p) & (PAGE_SIZE - 1))
+#define container_of(ptr, type, member) ((type *)((char *)(ptr) - offsetof(type, member)))
+
+// the kernel's restart after a signal, never returned to user space
+#define ERESTARTSYS 512
+
+// errors returned in pointers, as the kernel's ERR_PTR
+#define MAX_ERRNO 4095
+
+static inline void *ERR_PTR(long error)
+{
+	return (void *)error;
+}
+
+static inline long PTR_ERR(const void *ptr)
+{
+	return (long)ptr;
+}
+
+static inline bool IS_ERR(const void *ptr)
+{
+	return (uintptr_t)ptr >= (uintptr_t)-MAX_ERRNO;
+}
+
+// allocation flags, only __GFP_ZERO changes anything here
+#define GFP_KERNEL 0U
+#define GFP_ATOMIC 0U
+#define __GFP_ZERO 1U
+#define __GFP_NOWARN 0U
+#define __GFP_NORETRY 0U
+#define NUMA_NO_NODE (-1)
+
+#define PG_locked 0
+#define PG_referenced 1
+#define PG_dirty 2
+
+struct page {
+	void *data; // PAGE_SIZE bytes
+	int refcount;
+	unsigned long flags;
+};
+
+// single pages only, the node is ignored
+static inline struct page *alloc_pages_node(int nid, gfp_t gfp, unsigned int order)
+{
+	struct page *page;
+
+	if (order)
+		return NULL;
+	page = malloc(sizeof(*page));
+	if (!page)
+		return NULL;
+	page->data = (gfp & __GFP_ZERO) ? calloc(1, PAGE_SIZE) : malloc(PAGE_SIZE);
+	if (!page->data) {
+		free(page);
+		return NULL;
+	}
+	page->refcount = 1;
+	page->flags = 0;
+	return page;
+}
+
+static inline void __free_page(struct page *page)
+{
+	free(page->data);
+	free(page);
+}
+
+static inline void get_page(struct page *page)
+{
+	__atomic_add_fetch(&page->refcount, 1, __ATOMIC_RELAXED);
+}
+
+static inline void put_page(struct page *page)
+{
+	if (!__atomic_sub_fetch(&page->refcount, 1, __ATOMIC_ACQ_REL))
+		__free_page(page);
+}
+
+static inline int page_count(struct page *page)
+{
+	return __atomic_load_n(&page->refcount, __ATOMIC_ACQUIRE);
+}
+
+static inline bool get_page_unless_zero(struct page *page)
+{
+	int count = __atomic_load_n(&page->refcount, __ATOMIC_RELAXED);
+
+	do {
+		if (!count)
+			return false;
+	} while (!__atomic_compare_exchange_n(&page->refcount, &count, count + 1, false, __ATOMIC_ACQUIRE,
+					      __ATOMIC_RELAXED));
+	return true;
+}
+
+static inline bool PageReferenced(struct page *page)
+{
+	return __atomic_load_n(&page->flags, __ATOMIC_RELAXED) & (1UL << PG_referenced);
+}
+
+static inline void SetPageReferenced(struct page *page)
+{
+	__atomic_fetch_or(&page->flags, 1UL << PG_referenced, __ATOMIC_RELAXED);
+}
+
+static inline void ClearPageDirty(struct page *page)
+{
+	__atomic_fetch_and(&page->flags, ~(1UL << PG_dirty), __ATOMIC_RELAXED);
+}
+
+static inline void lock_page(struct page *page)
+{
+	while (__atomic_fetch_or(&page->flags, 1UL << PG_locked, __ATOMIC_ACQUIRE) & (1UL << PG_locked))
+		sched_yield();
+}
+
+static inline void unlock_page(struct page *page)
+{
+	__atomic_fetch_and(&page->flags, ~(1UL << PG_locked), __ATOMIC_RELEASE);
+}
+
+static inline void copy_highpage(struct page *to, struct page *from)
+{
+	memcpy(to->data, from->data, PAGE_SIZE);
+}
+
+static inline void flush_dcache_page(struct page *page)
+{
+}
+
+// nothing is mapped in user space
+struct address_space;
+
+static inline void unmap_mapping_range(struct address_space *mapping, loff_t start, loff_t len, int even_cows)
+{
+}
+
+// xarray: leaves of XA_LEAF_SIZE slots, allocated under xa_lock and published with a release store, so
+// xa_load and xa_get_mark need no lock. Indexes past XA_LEAVES leaves fail to store with -ENOMEM.
+#define XA_LEAF_SHIFT 10
+#define XA_LEAF_SIZE (1UL << XA_LEAF_SHIFT)
+#define XA_LEAVES 4096 // 16 GiB of 4 KiB pages
+
+typedef unsigned int xa_mark_t;
+#define XA_MARK_0 0U
+#define XA_MARK_1 1U
+#define XA_MARK_2 2U
+
+struct xa_leaf {
+	void *slots[XA_LEAF_SIZE];
+	unsigned char marks[XA_LEAF_SIZE];
+};
+
+struct xarray {
+	pthread_mutex_t lock;
+	struct xa_leaf *leaves[XA_LEAVES];
+};
+
+#define xa_lock(xa) pthread_mutex_lock(&(xa)->lock)
+#define xa_unlock(xa) pthread_mutex_unlock(&(xa)->lock)
+
+static inline void xa_init(struct xarray *xa)
+{
+	pthread_mutex_init(&xa->lock, NULL);
+	memset(xa->leaves, 0, sizeof(xa->leaves));
+}
+
+// frees the table, not the entries
+static inline void xa_destroy(struct xarray *xa)
+{
+	unsigned long i;
+
+	for (i = 0; i < XA_LEAVES; i++) {
+		free(xa->leaves[i]);
+		xa->leaves[i] = NULL;
+	}
+}
+
+static inline bool xa_is_err(const void *entry)
+{
+	return IS_ERR(entry);
+}
+
+static inline struct xa_leaf *xa_leaf(struct xarray *xa, unsigned long index)
+{
+	if (index >> XA_LEAF_SHIFT >= XA_LEAVES)
+		return NULL;
+	return __atomic_load_n(&xa->leaves[index >> XA_LEAF_SHIFT], __ATOMIC_ACQUIRE);
+}
+
+// the leaf of index for a store, called under xa_lock
+static inline struct xa_leaf *xa_leaf_create(struct xarray *xa, unsigned long index)
+{
+	struct xa_leaf *leaf = xa_leaf(xa, index);
+
+	if (leaf || index >> XA_LEAF_SHIFT >= XA_LEAVES)
+		return leaf;
+	leaf = calloc(1, sizeof(*leaf));
+	if (leaf)
+		__atomic_store_n(&xa->leaves[index >> XA_LEAF_SHIFT], leaf, __ATOMIC_RELEASE);
+	return leaf;
+}
+
+static inline void *xa_load(struct xarray *xa, unsigned long index)
+{
+	struct xa_leaf *leaf = xa_leaf(xa, index);
+
+	return leaf ? __atomic_load_n(&leaf->slots[index & (XA_LEAF_SIZE - 1)], __ATOMIC_ACQUIRE) : NULL;
+}
+
+// called under xa_lock, an emptied slot loses its marks
+static inline void *__xa_cmpxchg(struct xarray *xa, unsigned long index, void *old, void *entry, gfp_t gfp)
+{
+	struct xa_leaf *leaf = xa_leaf_create(xa, index);
+	unsigned long offset = index & (XA_LEAF_SIZE - 1);
+	void *curr;
+
+	if (!leaf)
+		return ERR_PTR(-ENOMEM);
+	curr = leaf->slots[offset];
+	if (curr == old) {
+		__atomic_store_n(&leaf->slots[offset], entry, __ATOMIC_RELEASE);
+		if (!entry)
+			__atomic_store_n(&leaf->marks[offset], 0, __ATOMIC_RELAXED);
+	}
+	return curr;
+}
+
+static inline void *xa_cmpxchg(struct xarray *xa, unsigned long index, void *old, void *entry, gfp_t gfp)
+{
+	void *curr;
+
+	xa_lock(xa);
+	curr = __xa_cmpxchg(xa, index, old, entry, gfp);
+	xa_unlock(xa);
+	return curr;
+}
+
+static inline void *xa_erase(struct xarray *xa, unsigned long index)
+{
+	void *curr;
+
+	xa_lock(xa);
+	curr = xa_load(xa, index);
+	if (curr)
+		__xa_cmpxchg(xa, index, curr, NULL, GFP_KERNEL);
+	xa_unlock(xa);
+	return curr;
+}
+
+static inline bool xa_get_mark(struct xarray *xa, unsigned long index, xa_mark_t mark)
+{
+	struct xa_leaf *leaf = xa_leaf(xa, index);
+
+	return leaf && (__atomic_load_n(&leaf->marks[index & (XA_LEAF_SIZE - 1)], __ATOMIC_RELAXED) >> mark) & 1;
+}
+
+// called under xa_lock
+static inline void __xa_clear_mark(struct xarray *xa, unsigned long index, xa_mark_t mark)
+{
+	struct xa_leaf *leaf = xa_leaf(xa, index);
+
+	if (leaf)
+		__atomic_fetch_and(&leaf->marks[index & (XA_LEAF_SIZE - 1)], ~(1U << mark), __ATOMIC_RELAXED);
+}
+
+// spinlocks
+typedef pthread_mutex_t spinlock_t;
+#define spin_lock_init(lock) pthread_mutex_init(lock, NULL)
+#define spin_lock(lock) pthread_mutex_lock(lock)
+#define spin_unlock(lock) pthread_mutex_unlock(lock)
+
+// doubly linked lists
+struct list_head {
+	struct list_head *next, *prev;
+};
+
+static inline void INIT_LIST_HEAD(struct list_head *list)
+{
+	list->next = list;
+	list->prev = list;
+}
+
+static inline void list_add_tail(struct list_head *entry, struct list_head *head)
+{
+	entry->prev = head->prev;
+	entry->next = head;
+	head->prev->next = entry;
+	head->prev = entry;
+}
+
+static inline void list_del(struct list_head *entry)
+{
+	entry->prev->next = entry->next;
+	entry->next->prev = entry->prev;
+}
+
+#define list_entry(ptr, type, member) container_of(ptr, type, member)
+#define list_for_each_entry(pos, head, member)                                   \
+	for (pos = list_entry((head)->next, __typeof__(*pos), member); &pos->member != (head); \
+	     pos = list_entry(pos->member.next, __typeof__(*pos), member))
+
+// wait queues: the condition is checked under the queue's mutex, so a wake up after the waker changed
+// the state can't be missed
+typedef struct {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+} wait_queue_head_t;
+
+static inline void init_waitqueue_head(wait_queue_head_t *wq)
+{
+	pthread_mutex_init(&wq->lock, NULL);
+	pthread_cond_init(&wq->cond, NULL);
+}
+
+static inline void wake_up_all(wait_queue_head_t *wq)
+{
+	pthread_mutex_lock(&wq->lock);
+	pthread_cond_broadcast(&wq->cond);
+	pthread_mutex_unlock(&wq->lock);
+}
+
+#define wait_event(wq, condition)                                  \
+	do {                                                       \
+		pthread_mutex_lock(&(wq).lock);                    \
+		while (!(condition))                               \
+			pthread_cond_wait(&(wq).cond, &(wq).lock); \
+		pthread_mutex_unlock(&(wq).lock);                  \
+	} while (0)
+// there are no fatal signals to wait for
+#define wait_event_killable(wq, condition) ({ wait_event(wq, condition); 0; })
+
+// iov_iter over a single kvec
+#define READ 0
+#define WRITE 1
+
+struct kvec {
+	void *iov_base;
+	size_t iov_len;
+};
+
+struct iov_iter {
+	char *base;
+	size_t count;
+};
+
+static inline void iov_iter_kvec(struct iov_iter *i, unsigned int direction, const struct kvec *kvec,
+				 unsigned long nr_segs, size_t count)
+{
+	i->base = kvec->iov_base;
+	i->count = count;
+}
+
+static inline size_t iov_iter_count(const struct iov_iter *i)
+{
+	return i->count;
+}
+
+static inline size_t copy_page_to_iter(struct page *page, size_t offset, size_t bytes, struct iov_iter *i)
+{
+	bytes = min_t(size_t, bytes, i->count);
+	memcpy(i->base, (char *)page->data + offset, bytes);
+	i->base += bytes;
+	i->count -= bytes;
+	return bytes;
+}
+
+static inline size_t copy_page_from_iter(struct page *page, size_t offset, size_t bytes, struct iov_iter *i)
+{
+	bytes = min_t(size_t, bytes, i->count);
+	memcpy((char *)page->data + offset, i->base, bytes);
+	i->base += bytes;
+	i->count -= bytes;
+	return bytes;
+}
+
+static inline size_t iov_iter_zero(size_t bytes, struct iov_iter *i)
+{
+	bytes = min_t(size_t, bytes, i->count);
+	memset(i->base, 0, bytes);
+	i->base += bytes;
+	i->count -= bytes;
+	return bytes;
+}
+
+#endif
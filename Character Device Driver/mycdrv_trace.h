@@ -0,0 +1,127 @@
+//Author - Venkata Sai Gireesh Chamarthi
+// tracepoints of the mycdrv data path, enable them under /sys/kernel/tracing/events/mycdrv/.
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM mycdrv
+
+#if !defined(_MYCDRV_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _MYCDRV_TRACE_H
+
+#include <linux/tracepoint.h>
+
+DECLARE_EVENT_CLASS(mycdrv_open_close,
+    TP_PROTO(int dev_num, int count),
+    TP_ARGS(dev_num, count),
+
+    TP_STRUCT__entry(
+        __field(int, dev_num)
+        __field(int, count)
+    ),
+
+    TP_fast_assign(
+        __entry->dev_num = dev_num;
+        __entry->count = count;
+    ),
+
+    TP_printk("dev=%d open_count=%d", __entry->dev_num, __entry->count)
+);
+
+DEFINE_EVENT(mycdrv_open_close, mycdrv_open,
+    TP_PROTO(int dev_num, int count),
+    TP_ARGS(dev_num, count)
+);
+
+DEFINE_EVENT(mycdrv_open_close, mycdrv_release,
+    TP_PROTO(int dev_num, int count),
+    TP_ARGS(dev_num, count)
+);
+
+DECLARE_EVENT_CLASS(mycdrv_rw,
+    TP_PROTO(int dev_num, loff_t pos, size_t len, ssize_t ret, u64 latency_ns),
+    TP_ARGS(dev_num, pos, len, ret, latency_ns),
+
+    TP_STRUCT__entry(
+        __field(int, dev_num)
+        __field(loff_t, pos)
+        __field(size_t, len)
+        __field(ssize_t, ret)
+        __field(u64, latency_ns)
+    ),
+
+    TP_fast_assign(
+        __entry->dev_num = dev_num;
+        __entry->pos = pos;
+        __entry->len = len;
+        __entry->ret = ret;
+        __entry->latency_ns = latency_ns;
+    ),
+
+    TP_printk("dev=%d pos=%lld len=%zu ret=%zd latency_ns=%llu",
+              __entry->dev_num, __entry->pos, __entry->len, __entry->ret,
+              __entry->latency_ns)
+);
+
+DEFINE_EVENT(mycdrv_rw, mycdrv_read,
+    TP_PROTO(int dev_num, loff_t pos, size_t len, ssize_t ret, u64 latency_ns),
+    TP_ARGS(dev_num, pos, len, ret, latency_ns)
+);
+
+DEFINE_EVENT(mycdrv_rw, mycdrv_write,
+    TP_PROTO(int dev_num, loff_t pos, size_t len, ssize_t ret, u64 latency_ns),
+    TP_ARGS(dev_num, pos, len, ret, latency_ns)
+);
+
+TRACE_EVENT(mycdrv_llseek,
+    TP_PROTO(int dev_num, loff_t offset, int whence, loff_t ret, size_t ram_size),
+    TP_ARGS(dev_num, offset, whence, ret, ram_size),
+
+    TP_STRUCT__entry(
+        __field(int, dev_num)
+        __field(loff_t, offset)
+        __field(int, whence)
+        __field(loff_t, ret)
+        __field(size_t, ram_size)
+    ),
+
+    TP_fast_assign(
+        __entry->dev_num = dev_num;
+        __entry->offset = offset;
+        __entry->whence = whence;
+        __entry->ret = ret;
+        __entry->ram_size = ram_size;
+    ),
+
+    TP_printk("dev=%d offset=%lld whence=%d ret=%lld ram_size=%zu",
+              __entry->dev_num, __entry->offset, __entry->whence,
+              __entry->ret, __entry->ram_size)
+);
+
+TRACE_EVENT(mycdrv_ioctl,
+    TP_PROTO(int dev_num, unsigned int cmd, long ret, u64 latency_ns),
+    TP_ARGS(dev_num, cmd, ret, latency_ns),
+
+    TP_STRUCT__entry(
+        __field(int, dev_num)
+        __field(unsigned int, cmd)
+        __field(long, ret)
+        __field(u64, latency_ns)
+    ),
+
+    TP_fast_assign(
+        __entry->dev_num = dev_num;
+        __entry->cmd = cmd;
+        __entry->ret = ret;
+        __entry->latency_ns = latency_ns;
+    ),
+
+    TP_printk("dev=%d cmd=0x%x ret=%ld latency_ns=%llu",
+              __entry->dev_num, __entry->cmd, __entry->ret, __entry->latency_ns)
+);
+
+#endif /* _MYCDRV_TRACE_H */
+
+// the trace header lives next to the driver, not in include/trace/events
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE mycdrv_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,212 @@
+//Author - Venkata Sai Gireesh Chamarthi
+// user space build of a mycdrv random-access device. The page store, the byte range locks and the copies
+// are the driver's own from mycdrv_core.c, compiled against mycdrv_shim.h. sem, size_lock and growing on
+// lseek mirror asp_mycdev and mycdrv_llseek. Compression, huge page runs and checksums aren't built.
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mycdrv_core.h"
+#include "mycdrv_user.h"
+
+// the driver's default ramdisk_size
+#define MYCDRV_USER_DEFAULT_SIZE (16 * PAGE_SIZE)
+
+// asp_mycdev as far as mycdrv_core.c uses it, plus the device lock and size
+typedef struct mycdrv_user_dev {
+	pthread_rwlock_t sem; // reads and writes share the device, growth and clearing are exclusive
+	struct xarray pages;
+	spinlock_t range_lock;
+	struct list_head ranges;
+	wait_queue_head_t rangeq;
+	spinlock_t size_lock; // serializes updates of buf_size
+	loff_t buf_size;
+	size_t ram_size; // changed under the exclusive lock
+	struct address_space *mapping; // always NULL, there is no mmap
+	bool huge;
+	bool integrity;
+} asp_mycdev;
+
+// the hooks of mycdrv_core.c, for the features that aren't built here
+static int mycdrv_page_node(asp_mycdev *dev, pgoff_t index)
+{
+	return NUMA_NO_NODE;
+}
+
+static bool mycdrv_is_zpage(void *entry)
+{
+	return false;
+}
+
+static struct page *mycdrv_decompress_page(asp_mycdev *dev, pgoff_t index)
+{
+	return ERR_PTR(-EIO);
+}
+
+static bool mycdrv_fill_huge(asp_mycdev *dev, pgoff_t index)
+{
+	return false;
+}
+
+static void mycdrv_crc_update(asp_mycdev *dev, pgoff_t index, struct page *page)
+{
+}
+
+static bool mycdrv_crc_verify(asp_mycdev *dev, pgoff_t index, struct page *page, bool force)
+{
+	return true;
+}
+
+// the nonblocking and uninterruptible range locks of the core have no user here
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-function"
+#include "mycdrv_core.c"
+#pragma GCC diagnostic pop
+
+struct mycdrv_user_dev *mycdrv_user_create(size_t size)
+{
+	struct mycdrv_user_dev *dev;
+
+	if (!size)
+		size = MYCDRV_USER_DEFAULT_SIZE;
+	size = (size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+	dev = calloc(1, sizeof(*dev));
+	if (!dev)
+		return NULL;
+	pthread_rwlock_init(&dev->sem, NULL);
+	xa_init(&dev->pages);
+	spin_lock_init(&dev->range_lock);
+	INIT_LIST_HEAD(&dev->ranges);
+	init_waitqueue_head(&dev->rangeq);
+	spin_lock_init(&dev->size_lock);
+	dev->ram_size = size;
+	return dev;
+}
+
+// release every populated page, called under the exclusive lock
+static void mycdrv_user_free_pages(struct mycdrv_user_dev *dev)
+{
+	struct page *page;
+	pgoff_t index;
+
+	for (index = 0; index < dev->ram_size >> PAGE_SHIFT; index++) {
+		page = xa_erase(&dev->pages, index);
+		if (page)
+			mycdrv_release_page(page);
+	}
+}
+
+void mycdrv_user_destroy(struct mycdrv_user_dev *dev)
+{
+	mycdrv_user_free_pages(dev);
+	xa_destroy(&dev->pages);
+	pthread_rwlock_destroy(&dev->sem);
+	free(dev);
+}
+
+ssize_t mycdrv_user_read(struct mycdrv_user_dev *dev, void *buf, size_t len, loff_t *pos)
+{
+	struct kvec kvec = { buf, len };
+	struct mycdrv_range range;
+	struct iov_iter to;
+	ssize_t ret = 0;
+
+	pthread_rwlock_rdlock(&dev->sem);
+	// reading past the end of the device returns 0
+	if (mycdrv_core_rw_fits(*pos, len, dev->ram_size)) {
+		iov_iter_kvec(&to, READ, &kvec, 1, len);
+		ret = mycdrv_range_lock(dev, &range, *pos, *pos + len, false);
+		if (!ret) {
+			ret = mycdrv_copy_to_iter(dev, *pos, len, &to);
+			if (ret > 0)
+				*pos += ret;
+			mycdrv_range_unlock(dev, &range);
+		}
+	}
+	pthread_rwlock_unlock(&dev->sem);
+	return ret;
+}
+
+ssize_t mycdrv_user_write(struct mycdrv_user_dev *dev, const void *buf, size_t len, loff_t *pos)
+{
+	struct kvec kvec = { (void *)buf, len };
+	struct mycdrv_range range;
+	struct iov_iter from;
+	ssize_t ret = 0;
+
+	pthread_rwlock_rdlock(&dev->sem);
+	// writing past the end of the device returns 0
+	if (mycdrv_core_rw_fits(*pos, len, dev->ram_size)) {
+		iov_iter_kvec(&from, WRITE, &kvec, 1, len);
+		ret = mycdrv_range_lock(dev, &range, *pos, *pos + len, true);
+		if (!ret) {
+			ret = mycdrv_copy_from_iter(dev, *pos, len, &from);
+			if (ret > 0) {
+				mycdrv_extend_buf_size(dev, *pos + ret);
+				*pos += ret;
+			}
+			mycdrv_range_unlock(dev, &range);
+		}
+	}
+	pthread_rwlock_unlock(&dev->sem);
+	return ret;
+}
+
+loff_t mycdrv_user_llseek(struct mycdrv_user_dev *dev, loff_t *f_pos, loff_t offset, int whence)
+{
+	loff_t pos;
+	int err;
+
+	pthread_rwlock_rdlock(&dev->sem);
+	err = mycdrv_core_seek_pos(*f_pos, offset, whence, mycdrv_user_buf_size(dev), &pos);
+	if (err) {
+		pthread_rwlock_unlock(&dev->sem);
+		return err;
+	}
+	if (mycdrv_core_seek_grows(pos, dev->ram_size)) {
+		// rwlocks can't be downgraded, the recheck covers another seeker growing in between. The new
+		// pages are holes, nothing is allocated.
+		pthread_rwlock_unlock(&dev->sem);
+		pthread_rwlock_wrlock(&dev->sem);
+		if (mycdrv_core_seek_grows(pos, dev->ram_size))
+			dev->ram_size = mycdrv_core_grow(dev->ram_size, PAGE_SIZE);
+		pthread_rwlock_unlock(&dev->sem);
+		pthread_rwlock_rdlock(&dev->sem);
+	}
+	pos = mycdrv_core_seek_clamp(pos);
+	*f_pos = pos;
+	pthread_rwlock_unlock(&dev->sem);
+	return pos;
+}
+
+void mycdrv_user_clear(struct mycdrv_user_dev *dev, loff_t *f_pos)
+{
+	pthread_rwlock_wrlock(&dev->sem);
+	mycdrv_user_free_pages(dev);
+	*f_pos = 0;
+	spin_lock(&dev->size_lock);
+	dev->buf_size = 0;
+	spin_unlock(&dev->size_lock);
+	pthread_rwlock_unlock(&dev->sem);
+}
+
+size_t mycdrv_user_ram_size(struct mycdrv_user_dev *dev)
+{
+	size_t size;
+
+	pthread_rwlock_rdlock(&dev->sem);
+	size = dev->ram_size;
+	pthread_rwlock_unlock(&dev->sem);
+	return size;
+}
+
+loff_t mycdrv_user_buf_size(struct mycdrv_user_dev *dev)
+{
+	loff_t size;
+
+	spin_lock(&dev->size_lock);
+	size = dev->buf_size;
+	spin_unlock(&dev->size_lock);
+	return size;
+}
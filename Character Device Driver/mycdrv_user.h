@@ -0,0 +1,27 @@
+//Author - Venkata Sai Gireesh Chamarthi
+// user space build of a mycdrv random-access device, libmycdrv.a. It runs the driver's page store, byte
+// range locks and copies from mycdrv_core.c and the seek and bounds logic of mycdrv_core.h, with the
+// kernel API supplied by mycdrv_shim.h, so the fuzzer and the benchmark exercise them without a kernel.
+#ifndef MYCDRV_USER_H
+#define MYCDRV_USER_H
+
+#include <sys/types.h>
+
+struct mycdrv_user_dev;
+
+// a device of size bytes rounded up to pages, 0 for the driver's default of 16 pages. NULL without memory.
+struct mycdrv_user_dev *mycdrv_user_create(size_t size);
+void mycdrv_user_destroy(struct mycdrv_user_dev *dev);
+
+// read and write at *pos like read(2) and write(2) on /dev/mycdrv<n> in random-access mode
+ssize_t mycdrv_user_read(struct mycdrv_user_dev *dev, void *buf, size_t len, loff_t *pos);
+ssize_t mycdrv_user_write(struct mycdrv_user_dev *dev, const void *buf, size_t len, loff_t *pos);
+// lseek(2) of a file at *f_pos, grows the device when seeking past its end
+loff_t mycdrv_user_llseek(struct mycdrv_user_dev *dev, loff_t *f_pos, loff_t offset, int whence);
+// ASP_CLEAR_BUF
+void mycdrv_user_clear(struct mycdrv_user_dev *dev, loff_t *f_pos);
+
+size_t mycdrv_user_ram_size(struct mycdrv_user_dev *dev);
+loff_t mycdrv_user_buf_size(struct mycdrv_user_dev *dev);
+
+#endif
@@ -7,10 +7,9 @@
 #include <stdlib.h>
 #include <fcntl.h>
 
-#define DEVICE "/dev/mycdrv"
+#include "mycdrv_ioctl.h"
 
-#define CDRV_IOC_MAGIC 'Z'
-#define ASP_CLEAR_BUF _IOW(CDRV_IOC_MAGIC, 1, int)
+#define DEVICE "/dev/mycdrv"
 
 
 int main(int argc, char *argv[]) {